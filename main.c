@@ -23,6 +23,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if (defined(__SSE2__) || defined(__AVX2__)) && !defined(NO_SIMD)
+#include <immintrin.h>
+#endif
 
 void *memcpy(void *str1, const void *str2, size_t n);
 
@@ -33,6 +41,36 @@ int min(int x, int y)
     return y;
 }
 
+double Now(void)   // Seconds, for timing
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+_Thread_local unsigned long long Seed = 88172645463325252ULL;   // Each thread plays with its own random sequence
+
+unsigned long long Random(void)   // xorshift64*, replaces rand() (which is shared between threads)
+{
+    Seed ^= Seed >> 12;
+    Seed ^= Seed << 25;
+    Seed ^= Seed >> 27;
+    
+    return (Seed * 2685821657736338717ULL) >> 1;
+}
+
+// Piece ID -> 1 pawn, 2 knight, 3 bishop, 4 rook, 5 queen, 6 king. IDs 17 to 24 are the promoted
+// pieces, queens unless a pawn underpromoted, so their kind is set by Promotion (and Load_FEN).
+
+_Thread_local int Kind[2][25] = {{0, 1, 1, 1, 1, 1, 1, 1, 1, 4, 2, 3, 5, 6, 3, 2, 4, 5, 5, 5, 5, 5, 5, 5, 5},
+                                 {0, 1, 1, 1, 1, 1, 1, 1, 1, 4, 2, 3, 5, 6, 3, 2, 4, 5, 5, 5, 5, 5, 5, 5, 5}};
+
+int Kind_ID[7] = {0, 1, 10, 11, 9, 12, 13};   // Kind -> ID of an unpromoted piece of that kind
+
+int Piece_Value[7] = {0, 100, 320, 330, 500, 900, 20000};   // By kind, in centipawns (the king's only counts in exchanges)
+
 void Show_Board(int b[8][8])
 {
     for (int i = 7; i >= 0; i--)
@@ -41,6 +79,9 @@ void Show_Board(int b[8][8])
         {
             int piece = b[i][j];
             
+            if(piece > 16){piece = Kind_ID[Kind[0][piece]];}    // Promoted pieces are shown as their kind
+            if(piece < -16){piece = -Kind_ID[Kind[1][-piece]];}
+            
             if(piece == 0)
             {
                 printf("   0   ");
@@ -63,7 +104,7 @@ void Show_Board(int b[8][8])
                 {
                     printf(" Bi(W) ");
                 }
-                if(piece == 12 || piece > 16)
+                if(piece == 12)
                 {
                     printf(" Qu(W) ");
                 }
@@ -90,7 +131,7 @@ void Show_Board(int b[8][8])
                 {
                     printf(" Bi(B) ");
                 }
-                if(piece == -12 || piece < -16)
+                if(piece == -12)
                 {
                     printf(" Qu(B) ");
                 }
@@ -104,7 +145,10 @@ void Show_Board(int b[8][8])
     }
 }
 
-int Board[8][8] = {{ 9,  10,  11,  12,  13,  14,  15,  16},
+// The whole game state is thread local, so each simulation thread plays on its own board.
+// A new thread starts with these initial values (the standard opening position).
+
+_Thread_local int Board[8][8] = {{ 9,  10,  11,  12,  13,  14,  15,  16},
                    { 1,   2,   3,   4,   5,   6,   7,   8},
                    { 0,   0,   0,   0,   0,   0,   0,   0},
                    { 0,   0,   0,   0,   0,   0,   0,   0},
@@ -114,24 +158,340 @@ int Board[8][8] = {{ 9,  10,  11,  12,  13,  14,  15,  16},
                    {-9, -10, -11, -12, -13, -14, -15, -16}};
 
 
-int Pieces[2][25][2] = {{{8,8},
+_Thread_local int Pieces[2][25][2] = {{{8,8},
                          {1,0},{1,1},{1,2},{1,3},{1,4},{1,5},{1,6},{1,7},{0,0},{0,1},{0,2},{0,3},{0,4},{0,5},{0,6},{0,7},
                          {8,8},{8,8},{8,8},{8,8},{8,8},{8,8},{8,8},{8,8}},
                         {{8,8},
                          {6,0},{6,1},{6,2},{6,3},{6,4},{6,5},{6,6},{6,7},{7,0},{7,1},{7,2},{7,3},{7,4},{7,5},{7,6},{7,7},
                          {8,8},{8,8},{8,8},{8,8},{8,8},{8,8},{8,8},{8,8}}};
 
-int MoveStack[500][6] = {0};  // This stores the valid moves for one team at the current round. 500 is high enough to avoid a stackoverflow
+_Thread_local int MoveStack[16384][6] = {0};  // This stores the valid moves for one team at the current round. While searching, the moves of
+                                              // each ply are stacked after the ones of the previous ply (64 plies of up to 256 moves)
+
+_Thread_local int QCastle_W = 1;   // Still can Queen Castle
+_Thread_local int QCastle_B = 1;
+
+_Thread_local int KCastle_W = 1;   // Still can King Castle
+_Thread_local int KCastle_B = 1;
+
+_Thread_local int PQueens_W = 0;   // Promoted Queens (and underpromoted pieces), the next one gets ID 17 + PQueens
+_Thread_local int PQueens_B = 0;
+
+_Thread_local int Last_Move[6] = {-1, 0, 0, 0, 0, 0};   // Needed for En Passant. Type -1 = no last move
+
+// Zobrist hashing. The keys are shared by all threads (filled once by Init_Zobrist), the hash of the
+// position being played is thread local. Move and Promotion keep the piece part of it up to date,
+// Make_Move the castling rights, En Passant file and team to move. Load_FEN computes it from scratch.
+
+unsigned long long Zobrist[2][7][64];   // [team][kind][rank*8 + file]
+unsigned long long Zobrist_Castle[4];   // QCastle_W, KCastle_W, QCastle_B, KCastle_B
+unsigned long long Zobrist_EP[8];       // En Passant file
+unsigned long long Zobrist_Side;        // Black to move
+
+_Thread_local unsigned long long Hash = 0;
+_Thread_local unsigned long long Pawn_Hash = 0;   // Of the pawns only, for the pawn structure table
+
+// Bitboards: one bit per square (rank*8 + file), for each team and piece kind (kind 0 = all the team's
+// pieces). Kept up to date with the hash, they are what the bitboard move generator works on.
+
+_Thread_local unsigned long long Bitboards[2][7];
+
+// Evaluation: material plus piece-square tables (what a piece is worth on each square, on top of its
+// material). Each team's sums are kept up to date by Toggle, with the hash and the bitboards, so
+// evaluating a position takes no more than a subtraction and a blend. The tables are from White's side, a8 first as the board
+// is printed; Black reads them mirrored.
+
+const int PST[7][64] =
+{
+    {0},
+    {  0,   0,   0,   0,   0,   0,   0,   0,     // Pawn
+      50,  50,  50,  50,  50,  50,  50,  50,
+      10,  10,  20,  30,  30,  20,  10,  10,
+       5,   5,  10,  25,  25,  10,   5,   5,
+       0,   0,   0,  20,  20,   0,   0,   0,
+       5,  -5, -10,   0,   0, -10,  -5,   5,
+       5,  10,  10, -20, -20,  10,  10,   5,
+       0,   0,   0,   0,   0,   0,   0,   0},
+    {-50, -40, -30, -30, -30, -30, -40, -50,     // Knight
+     -40, -20,   0,   0,   0,   0, -20, -40,
+     -30,   0,  10,  15,  15,  10,   0, -30,
+     -30,   5,  15,  20,  20,  15,   5, -30,
+     -30,   0,  15,  20,  20,  15,   0, -30,
+     -30,   5,  10,  15,  15,  10,   5, -30,
+     -40, -20,   0,   5,   5,   0, -20, -40,
+     -50, -40, -30, -30, -30, -30, -40, -50},
+    {-20, -10, -10, -10, -10, -10, -10, -20,     // Bishop
+     -10,   0,   0,   0,   0,   0,   0, -10,
+     -10,   0,   5,  10,  10,   5,   0, -10,
+     -10,   5,   5,  10,  10,   5,   5, -10,
+     -10,   0,  10,  10,  10,  10,   0, -10,
+     -10,  10,  10,  10,  10,  10,  10, -10,
+     -10,   5,   0,   0,   0,   0,   5, -10,
+     -20, -10, -10, -10, -10, -10, -10, -20},
+    {  0,   0,   0,   0,   0,   0,   0,   0,     // Rook
+       5,  10,  10,  10,  10,  10,  10,   5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+       0,   0,   0,   5,   5,   0,   0,   0},
+    {-20, -10, -10,  -5,  -5, -10, -10, -20,     // Queen
+     -10,   0,   0,   0,   0,   0,   0, -10,
+     -10,   0,   5,   5,   5,   5,   0, -10,
+      -5,   0,   5,   5,   5,   5,   0,  -5,
+       0,   0,   5,   5,   5,   5,   0,  -5,
+     -10,   5,   5,   5,   5,   5,   0, -10,
+     -10,   0,   5,   0,   0,   0,   0, -10,
+     -20, -10, -10,  -5,  -5, -10, -10, -20},
+    {-30, -40, -40, -50, -50, -40, -40, -30,     // King
+     -30, -40, -40, -50, -50, -40, -40, -30,
+     -30, -40, -40, -50, -50, -40, -40, -30,
+     -30, -40, -40, -50, -50, -40, -40, -30,
+     -20, -30, -30, -40, -40, -30, -30, -20,
+     -10, -20, -20, -20, -20, -20, -20, -10,
+      20,  20,   0,   0,   0,   0,  20,  20,
+      20,  30,  10,   0,   0,  10,  30,  20},
+};
+
+// The endgame has its own material values and its own tables for the pawns (worth more the closer
+// they are to promotion) and the king (wanted in the centre); the other pieces keep theirs. The two
+// scores are blended by the phase: 24 with all the pieces on the board, 0 with pawns and kings only.
+
+int Piece_Value_EG[7] = {0, 120, 290, 310, 530, 950, 0};
+int Phase_Weight[7] = {0, 0, 1, 1, 2, 4, 0};   // By kind
+
+const int PST_EG[7][64] =
+{
+    [1] =
+    {  0,   0,   0,   0,   0,   0,   0,   0,     // Pawn
+      90,  90,  90,  90,  90,  90,  90,  90,
+      60,  60,  60,  60,  60,  60,  60,  60,
+      35,  35,  35,  35,  35,  35,  35,  35,
+      20,  20,  20,  20,  20,  20,  20,  20,
+      10,  10,  10,  10,  10,  10,  10,  10,
+       0,   0,   0,   0,   0,   0,   0,   0,
+       0,   0,   0,   0,   0,   0,   0,   0},
+    [6] =
+    {-50, -40, -30, -20, -20, -30, -40, -50,     // King
+     -30, -20, -10,   0,   0, -10, -20, -30,
+     -30, -10,  20,  30,  30,  20, -10, -30,
+     -30, -10,  30,  40,  40,  30, -10, -30,
+     -30, -10,  30,  40,  40,  30, -10, -30,
+     -30, -10,  20,  30,  30,  20, -10, -30,
+     -30, -30,   0,   0,   0,   0, -30, -30,
+     -50, -30, -30, -30, -30, -30, -30, -50},
+};
+
+int PSQ_MG[2][7][64];              // Material (not the king's) plus table, by team, kind and square
+int PSQ_EG[2][7][64];
+_Thread_local int MG_Score[2];     // Sums of PSQ_MG and PSQ_EG over each team's pieces
+_Thread_local int EG_Score[2];
+_Thread_local int Phase;           // Sum of Phase_Weight over the pieces (more than 24 after promotions)
+
+void Init_Eval(void)
+{
+    for(int k = 1; k < 7; k++)
+    {
+        for(int sq = 0; sq < 64; sq++)
+        {
+            for(int t = 0; t < 2; t++)
+            {
+                int i = t == 0 ? sq ^ 56 : sq;   // Index in the tables
+                
+                PSQ_MG[t][k][sq] = (k < 6 ? Piece_Value[k] : 0) + PST[k][i];
+                PSQ_EG[t][k][sq] = Piece_Value_EG[k] + (k == 1 || k == 6 ? PST_EG[k][i] : PST[k][i]);
+            }
+        }
+    }
+}
+
+// Neural network evaluation (NNUE): see NNUE_Evaluate. Its first layer sums a column of weights for
+// every piece on the board, as seen from each king. Make_Move pushes an entry on a stack of these sums
+// (accumulators), Toggle writes there which pieces appeared or left, and the entry is only worked out
+// when a position is evaluated, from the closest entry below it that is up to date. Unmake_Move pops
+// the entry, so the sums of the position before the move are there again without any work.
+
+#define NNUE_HIDDEN 256
+#define NNUE_STACK 128
+
+typedef struct
+{
+    _Alignas(64) short v[2][NNUE_HIDDEN];   // Sums seen from White's king and from Black's
+    int computed[2];
+    int changes;                            // Pieces that appeared or left with the move to this position
+    int change[6][4];                       // Team, kind, square, 1 = appeared (a promoting capture makes 5)
+} NNUE_Accumulator;
+
+int NNUE_Loaded = 0;
+
+_Thread_local NNUE_Accumulator Acc_Stack[NNUE_STACK];
+_Thread_local int Acc_Top = 0;
+
+void NNUE_Reset(void)   // New position: nothing computed
+{
+    Acc_Top = 0;
+    Acc_Stack[0].computed[0] = 0;
+    Acc_Stack[0].computed[1] = 0;
+}
+
+int NNUE_Push(void)   // Make_Move: the entry of the new position. Returns the old top
+{
+    int top = Acc_Top;
+    
+    if(Acc_Top < NNUE_STACK - 1){Acc_Top += 1;}   // Full (long games out of search): the top entry is reused and refreshed
+    
+    NNUE_Accumulator *a = &Acc_Stack[Acc_Top];
+    
+    a->computed[0] = 0;
+    a->computed[1] = 0;
+    a->changes = Acc_Top == top ? 7 : 0;   // More than 6: refresh
+    
+    return top;
+}
+
+void NNUE_Pop(int top)   // Unmake_Move
+{
+    if(top == Acc_Top)   // The reused top entry holds the sums of the position after the move
+    {
+        Acc_Stack[top].computed[0] = 0;
+        Acc_Stack[top].computed[1] = 0;
+        Acc_Stack[top].changes = 7;
+    }
+    Acc_Top = top;
+}
+
+void Toggle(int t, int k, int sq)   // A piece of team t and kind k appears on (or leaves) square sq
+{
+    Hash ^= Zobrist[t][k][sq];
+    
+    Bitboards[t][k] ^= 1ULL << sq;
+    Bitboards[t][0] ^= 1ULL << sq;
+    
+    int s = (Bitboards[t][k] >> sq & 1) ? 1 : -1;   // Appears or leaves
+    
+    MG_Score[t] += s * PSQ_MG[t][k][sq];
+    EG_Score[t] += s * PSQ_EG[t][k][sq];
+    Phase += s * Phase_Weight[k];
+    
+    if(k == 1){Pawn_Hash ^= Zobrist[t][1][sq];}
+    
+    if(NNUE_Loaded)
+    {
+        NNUE_Accumulator *a = &Acc_Stack[Acc_Top];
+        
+        if(a->changes < 6)
+        {
+            int *c = a->change[a->changes++];
+            
+            c[0] = t;
+            c[1] = k;
+            c[2] = sq;
+            c[3] = s > 0;
+        }
+        else{a->changes = 7;}
+    }
+}
+
+void Compute_Eval(void)   // Evaluation sums and pawn hash from the bitboards, when a position is set up
+{
+    Phase = 0;
+    Pawn_Hash = 0;
+    
+    for(int t = 0; t < 2; t++)
+    {
+        MG_Score[t] = 0;
+        EG_Score[t] = 0;
+        
+        for(int k = 1; k < 7; k++)
+        {
+            for(unsigned long long b = Bitboards[t][k]; b != 0; b &= b - 1)
+            {
+                MG_Score[t] += PSQ_MG[t][k][__builtin_ctzll(b)];
+                EG_Score[t] += PSQ_EG[t][k][__builtin_ctzll(b)];
+                Phase += Phase_Weight[k];
+                
+                if(k == 1){Pawn_Hash ^= Zobrist[t][1][__builtin_ctzll(b)];}
+            }
+        }
+    }
+}
+
+typedef struct   // What Make_Move changed and Unmake_Move needs back
+{
+    unsigned long long hash;
+    unsigned long long bitboards[2][7];
+    int captured;   // Board piece taken (or the falling pawn of an En Passant)
+    int castle[4];  // QCastle_W, KCastle_W, QCastle_B, KCastle_B
+    int pqueens[2];
+    int last_move[6];
+    int mg[2];      // MG_Score, EG_Score and Phase
+    int eg[2];
+    int phase;
+    unsigned long long pawn_hash;
+    int acc_top;
+} Undo;
+
+const char *Start_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
-int QCastle_W = 1;   // Still can Queen Castle
-int QCastle_B = 1;
 
-int KCastle_W = 1;   // Still can King Castle
-int KCastle_B = 1;
+void Init_Zobrist(void)
+{
+    unsigned long long s = Seed;   // Same keys on every run, whatever the main thread's seed was
+    
+    Seed = 1070372ULL;
+    
+    for(int t = 0; t < 2; t++)
+    {
+        for(int k = 0; k < 7; k++)
+        {
+            for(int sq = 0; sq < 64; sq++)
+            {
+                Zobrist[t][k][sq] = Random() ^ (Random() << 32);
+            }
+        }
+    }
+    for(int i = 0; i < 4; i++){Zobrist_Castle[i] = Random() ^ (Random() << 32);}
+    for(int i = 0; i < 8; i++){Zobrist_EP[i] = Random() ^ (Random() << 32);}
+    Zobrist_Side = Random() ^ (Random() << 32);
+    
+    Seed = s;
+}
 
-int PQueens_W = 0;   // Promoted Queens
-int PQueens_B = 0;
+unsigned long long State_Hash(void)   // Castling rights and En Passant file part of the hash
+{
+    unsigned long long h = 0;
+    
+    if(QCastle_W){h ^= Zobrist_Castle[0];}
+    if(KCastle_W){h ^= Zobrist_Castle[1];}
+    if(QCastle_B){h ^= Zobrist_Castle[2];}
+    if(KCastle_B){h ^= Zobrist_Castle[3];}
+    
+    if(Last_Move[0] == 0 && Last_Move[1] > -9 && Last_Move[1] < 9 && (Last_Move[4] - Last_Move[2] == 2 || Last_Move[2] - Last_Move[4] == 2))
+    {
+        h ^= Zobrist_EP[Last_Move[5]];
+    }
+    return h;
+}
 
+unsigned long long Compute_Hash(int team)   // From scratch
+{
+    unsigned long long h = State_Hash();
+    
+    for(int t = 0; t < 2; t++)
+    {
+        for(int p = 1; p < 25; p++)
+        {
+            if(Pieces[t][p][0] != 8)
+            {
+                h ^= Zobrist[t][Kind[t][p]][Pieces[t][p][0]*8 + Pieces[t][p][1]];
+            }
+        }
+    }
+    if(team == 1){h ^= Zobrist_Side;}
+    
+    return h;
+}
 
 int Check(int team)
 {
@@ -150,7 +510,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p > 0){break;}
             else if(i == 1 && p == -13){return 1;}
-            else if(p == -9 || p == -12 || p <= -16){return 1;}  // <= -16 : rook or (promoted) queen
+            else if(p == -9 || p == -12 || p == -16 || (p < -16 && Kind[1][-p] >= 4)){return 1;}  // Rook or queen, promoted ones included
             else{break;}
         }
         for(int i = 1; i < R+1; i++)  // S
@@ -160,7 +520,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p > 0){break;}
             else if(i == 1 && p == -13){return 1;}
-            else if(p == -9 || p == -12 || p <= -16){return 1;}  // <= -16 : rook or (promoted) queen
+            else if(p == -9 || p == -12 || p == -16 || (p < -16 && Kind[1][-p] >= 4)){return 1;}  // Rook or queen, promoted ones included
             else{break;}
         }
         for(int i = 1; i < 8-F; i++)  // E
@@ -170,7 +530,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p > 0){break;}
             else if(i == 1 && p == -13){return 1;}
-            else if(p == -9 || p == -12 || p <= -16){return 1;}  // <= -16 : rook or (promoted) queen
+            else if(p == -9 || p == -12 || p == -16 || (p < -16 && Kind[1][-p] >= 4)){return 1;}  // Rook or queen, promoted ones included
             else{break;}
         }
         for(int i = 1; i < F+1; i++)  // W
@@ -180,7 +540,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p > 0){break;}
             else if(i == 1 && p == -13){return 1;}
-            else if(p == -9 || p == -12 || p <= -16){return 1;}  // <= -16 : rook or (promoted) queen
+            else if(p == -9 || p == -12 || p == -16 || (p < -16 && Kind[1][-p] >= 4)){return 1;}  // Rook or queen, promoted ones included
             else{break;}
         }
         
@@ -191,7 +551,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p > 0){break;}
             else if(i == 1 && (p > -9 || p == -13)){return 1;}
-            else if(p == -11 || p == -12 || p == -14 || p < -16){return 1;}
+            else if(p == -11 || p == -12 || p == -14 || (p < -16 && (Kind[1][-p] == 3 || Kind[1][-p] == 5))){return 1;}
             else{break;}
         }
         for(int i = 1; i < min(8-R,F+1); i++)  // NW
@@ -201,7 +561,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p > 0){break;}
             else if(i == 1 && (p > -9 || p == -13)){return 1;}
-            else if(p == -11 || p == -12 || p == -14 || p < -16){return 1;}
+            else if(p == -11 || p == -12 || p == -14 || (p < -16 && (Kind[1][-p] == 3 || Kind[1][-p] == 5))){return 1;}
             else{break;}
         }
         for(int i = 1; i < min(R+1,F+1); i++)  // SW
@@ -211,7 +571,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p > 0){break;}
             else if(i == 1 && p == -13){return 1;}
-            else if(p == -11 || p == -12 || p == -14 || p < -16){return 1;}
+            else if(p == -11 || p == -12 || p == -14 || (p < -16 && (Kind[1][-p] == 3 || Kind[1][-p] == 5))){return 1;}
             else{break;}
         }
         for(int i = 1; i < min(R+1,8-F); i++)  // SE
@@ -221,7 +581,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p > 0){break;}
             else if(i == 1 && p == -13){return 1;}
-            else if(p == -11 || p == -12 || p == -14 || p < -16){return 1;}
+            else if(p == -11 || p == -12 || p == -14 || (p < -16 && (Kind[1][-p] == 3 || Kind[1][-p] == 5))){return 1;}
             else{break;}
         }
         
@@ -229,49 +589,49 @@ int Check(int team)
         {
             p = Board[R+1][F+2];
             
-            if(p == -10 || p == -15){return 1;}
+            if(p == -10 || p == -15 || (p < -16 && Kind[1][-p] == 2)){return 1;}
         }
         if(R < 6 && F < 7)  // Kn_2
         {
             p = Board[R+2][F+1];
             
-            if(p == -10 || p == -15){return 1;}
+            if(p == -10 || p == -15 || (p < -16 && Kind[1][-p] == 2)){return 1;}
         }
         if(R < 6 && F > 0)  // Kn_3
         {
             p = Board[R+2][F-1];
             
-            if(p == -10 || p == -15){return 1;}
+            if(p == -10 || p == -15 || (p < -16 && Kind[1][-p] == 2)){return 1;}
         }
         if(R < 7 && F > 1)  // Kn_4
         {
             p = Board[R+1][F-2];
             
-            if(p == -10 || p == -15){return 1;}
+            if(p == -10 || p == -15 || (p < -16 && Kind[1][-p] == 2)){return 1;}
         }
         if(R > 0 && F > 1)  // Kn_5
         {
             p = Board[R-1][F-2];
             
-            if(p == -10 || p == -15){return 1;}
+            if(p == -10 || p == -15 || (p < -16 && Kind[1][-p] == 2)){return 1;}
         }
         if(R > 1 && F > 0)  // Kn_6
         {
             p = Board[R-2][F-1];
             
-            if(p == -10 || p == -15){return 1;}
+            if(p == -10 || p == -15 || (p < -16 && Kind[1][-p] == 2)){return 1;}
         }
         if(R > 1 && F < 7)  // Kn_7
         {
             p = Board[R-2][F+1];
             
-            if(p == -10 || p == -15){return 1;}
+            if(p == -10 || p == -15 || (p < -16 && Kind[1][-p] == 2)){return 1;}
         }
         if(R > 0 && F < 6)  // Kn_8
         {
             p = Board[R-1][F+2];
             
-            if(p == -10 || p == -15){return 1;}
+            if(p == -10 || p == -15 || (p < -16 && Kind[1][-p] == 2)){return 1;}
         }
         
         return 0;
@@ -290,7 +650,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p < 0){break;}
             else if(i == 1 && p == 13){return 1;}
-            else if(p == 9 || p == 12 || p >= 16){return 1;}  // >= 16 : rook or (promoted) queen
+            else if(p == 9 || p == 12 || p == 16 || (p > 16 && Kind[0][p] >= 4)){return 1;}  // Rook or queen, promoted ones included
             else{break;}
         }
         for(int i = 1; i < R+1; i++)  // S
@@ -300,7 +660,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p < 0){break;}
             else if(i == 1 && p == 13){return 1;}
-            else if(p == 9 || p == 12 || p >= 16){return 1;}
+            else if(p == 9 || p == 12 || p == 16 || (p > 16 && Kind[0][p] >= 4)){return 1;}
             else{break;}
         }
         for(int i = 1; i < 8-F; i++)  // E
@@ -310,7 +670,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p < 0){break;}
             else if(i == 1 && p == 13){return 1;}
-            else if(p == 9 || p == 12 || p >= 16){return 1;}
+            else if(p == 9 || p == 12 || p == 16 || (p > 16 && Kind[0][p] >= 4)){return 1;}
             else{break;}
         }
         for(int i = 1; i < F+1; i++)  // W
@@ -320,7 +680,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p < 0){break;}
             else if(i == 1 && p == 13){return 1;}
-            else if(p == 9 || p == 12 || p >= 16){return 1;}
+            else if(p == 9 || p == 12 || p == 16 || (p > 16 && Kind[0][p] >= 4)){return 1;}
             else{break;}
         }
         
@@ -331,7 +691,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p < 0){break;}
             else if(i == 1 && p == 13){return 1;}
-            else if(p == 11 || p == 12 || p == 14 || p > 16){return 1;}
+            else if(p == 11 || p == 12 || p == 14 || (p > 16 && (Kind[0][p] == 3 || Kind[0][p] == 5))){return 1;}
             else{break;}
         }
         for(int i = 1; i < min(8-R,F+1); i++)  // NW
@@ -341,7 +701,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p < 0){break;}
             else if(i == 1 && p == 13){return 1;}
-            else if(p == 11 || p == 12 || p == 14 || p > 16){return 1;}
+            else if(p == 11 || p == 12 || p == 14 || (p > 16 && (Kind[0][p] == 3 || Kind[0][p] == 5))){return 1;}
             else{break;}
         }
         for(int i = 1; i < min(R+1,F+1); i++)  // SW
@@ -351,7 +711,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p < 0){break;}
             else if(i == 1 && (p < 9 || p == 13)){return 1;}
-            else if(p == 11 || p == 12 || p == 14 || p > 16){return 1;}
+            else if(p == 11 || p == 12 || p == 14 || (p > 16 && (Kind[0][p] == 3 || Kind[0][p] == 5))){return 1;}
             else{break;}
         }
         for(int i = 1; i < min(R+1,8-F); i++)  // SE
@@ -361,7 +721,7 @@ int Check(int team)
             if(p == 0){continue;}
             else if(p < 0){break;}
             else if(i == 1 && (p < 9 || p == 13)){return 1;}
-            else if(p == 11 || p == 12 || p == 14 || p > 16){return 1;}
+            else if(p == 11 || p == 12 || p == 14 || (p > 16 && (Kind[0][p] == 3 || Kind[0][p] == 5))){return 1;}
             else{break;}
         }
         
@@ -369,49 +729,49 @@ int Check(int team)
         {
             p = Board[R+1][F+2];
             
-            if(p == 10 || p == 15){return 1;}
+            if(p == 10 || p == 15 || (p > 16 && Kind[0][p] == 2)){return 1;}
         }
         if(R < 6 && F < 7)  // Kn_2
         {
             p = Board[R+2][F+1];
             
-            if(p == 10 || p == 15){return 1;}
+            if(p == 10 || p == 15 || (p > 16 && Kind[0][p] == 2)){return 1;}
         }
         if(R < 6 && F > 0)  // Kn_3
         {
             p = Board[R+2][F-1];
             
-            if(p == 10 || p == 15){return 1;}
+            if(p == 10 || p == 15 || (p > 16 && Kind[0][p] == 2)){return 1;}
         }
         if(R < 7 && F > 1)  // Kn_4
         {
             p = Board[R+1][F-2];
             
-            if(p == 10 || p == 15){return 1;}
+            if(p == 10 || p == 15 || (p > 16 && Kind[0][p] == 2)){return 1;}
         }
         if(R > 0 && F > 1)  // Kn_5
         {
             p = Board[R-1][F-2];
             
-            if(p == 10 || p == 15){return 1;}
+            if(p == 10 || p == 15 || (p > 16 && Kind[0][p] == 2)){return 1;}
         }
         if(R > 1 && F > 0)  // Kn_6
         {
             p = Board[R-2][F-1];
             
-            if(p == 10 || p == 15){return 1;}
+            if(p == 10 || p == 15 || (p > 16 && Kind[0][p] == 2)){return 1;}
         }
         if(R > 1 && F < 7)  // Kn_7
         {
             p = Board[R-2][F+1];
             
-            if(p == 10 || p == 15){return 1;}
+            if(p == 10 || p == 15 || (p > 16 && Kind[0][p] == 2)){return 1;}
         }
         if(R > 0 && F < 6)  // Kn_8
         {
             p = Board[R-1][F+2];
             
-            if(p == 10 || p == 15){return 1;}
+            if(p == 10 || p == 15 || (p > 16 && Kind[0][p] == 2)){return 1;}
         }
         
         return 0;
@@ -420,7 +780,7 @@ int Check(int team)
 
 void Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
 {
-    if(type == 0)  // Normal move
+    if(type == 0 || type >= 4)  // Normal move (4, 5 and 6 are the underpromotions)
     {
         int mp = arg0;  // Moving piece
         
@@ -439,10 +799,15 @@ void Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
             Pieces[0][mp][0] = d_r;
             Pieces[0][mp][1] = d_f;
             
+            Toggle(0, Kind[0][mp], o_r*8 + o_f);
+            Toggle(0, Kind[0][mp], d_r*8 + d_f);
+            
             if(bp != 0)
             {
                 Pieces[1][-bp][0] = 8;  // 8 = out of board
                 Pieces[1][-bp][1] = 8;
+                
+                Toggle(1, Kind[1][-bp], d_r*8 + d_f);
             }
         }
         else
@@ -453,10 +818,15 @@ void Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
             Pieces[1][-mp][0] = d_r;
             Pieces[1][-mp][1] = d_f;
             
+            Toggle(1, Kind[1][-mp], o_r*8 + o_f);
+            Toggle(1, Kind[1][-mp], d_r*8 + d_f);
+            
             if(bp != 0)
             {
                 Pieces[0][bp][0] = 8;
                 Pieces[0][bp][1] = 8;
+                
+                Toggle(0, Kind[0][bp], d_r*8 + d_f);
             }
         }
     }
@@ -477,6 +847,11 @@ void Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
             
             Pieces[0][13][0] = 0;
             Pieces[0][13][1] = 2;
+            
+            Toggle(0, 4, 0);
+            Toggle(0, 4, 3);
+            Toggle(0, 6, 4);
+            Toggle(0, 6, 2);
         }
         else
         {
@@ -491,6 +866,11 @@ void Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
             
             Pieces[1][13][0] = 7;
             Pieces[1][13][1] = 2;
+            
+            Toggle(1, 4, 56);
+            Toggle(1, 4, 59);
+            Toggle(1, 6, 60);
+            Toggle(1, 6, 58);
         }
     }
     if(type == 2)  // King's Castle
@@ -509,6 +889,11 @@ void Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
             
             Pieces[0][16][0] = 0;
             Pieces[0][16][1] = 5;
+            
+            Toggle(0, 4, 7);
+            Toggle(0, 4, 5);
+            Toggle(0, 6, 4);
+            Toggle(0, 6, 6);
         }
         else
         {
@@ -522,6 +907,11 @@ void Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
             
             Pieces[1][16][0] = 7;
             Pieces[1][16][1] = 5;
+            
+            Toggle(1, 4, 63);
+            Toggle(1, 4, 61);
+            Toggle(1, 6, 60);
+            Toggle(1, 6, 62);
         }
     }
     if(type == 3)  // En Passant
@@ -546,6 +936,10 @@ void Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
             
             Pieces[1][-fp][0] = 8;
             Pieces[1][-fp][1] = 8;
+            
+            Toggle(0, 1, o_r*8 + o_f);
+            Toggle(0, 1, d_r*8 + d_f);
+            Toggle(1, 1, (d_r-1)*8 + d_f);
         }
         else
         {
@@ -560,6 +954,10 @@ void Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
             
             Pieces[0][fp][0] = 8;
             Pieces[0][fp][1] = 8;
+            
+            Toggle(1, 1, o_r*8 + o_f);
+            Toggle(1, 1, d_r*8 + d_f);
+            Toggle(0, 1, (d_r+1)*8 + d_f);
         }
     }
 }
@@ -770,7 +1168,7 @@ int Legal(int type, int arg0, int arg1, int arg2, int arg3, int arg4)
         }
         else
         {
-            if(Board[7][4] == -13 && Board[7][5] == 0 && Board[7][6] == 0 && Board[0][7] == -16)
+            if(Board[7][4] == -13 && Board[7][5] == 0 && Board[7][6] == 0 && Board[7][7] == -16)
             {
                 if(!Check(1))
                 {
@@ -868,21 +1266,21 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
         
         if(p < 9)
         {
-            if(p_r == 1)
+            if(Board[p_r+1][p_f] == 0)
             {
-                if(Board[p_r+1][p_f] == 0)
+                if(Legal(0, p, p_r, p_f, p_r+1, p_f))
+                {
+                    MoveStack[LM][0] = 0;
+                    MoveStack[LM][1] = p;
+                    MoveStack[LM][2] = p_r;
+                    MoveStack[LM][3] = p_f;
+                    MoveStack[LM][4] = p_r+1;
+                    MoveStack[LM][5] = p_f;
+                    
+                    LM += 1;
+                }
+                if(p_r == 1)
                 {
-                    if(Legal(0, p, p_r, p_f, p_r+1, p_f))
-                    {
-                        MoveStack[LM][0] = 0;
-                        MoveStack[LM][1] = p;
-                        MoveStack[LM][2] = p_r;
-                        MoveStack[LM][3] = p_f;
-                        MoveStack[LM][4] = p_r+1;
-                        MoveStack[LM][5] = p_f;
-                        
-                        LM += 1;
-                    }
                     if(Board[p_r+2][p_f] == 0)
                     {
                         if(Legal(0, p, p_r, p_f, p_r+2, p_f))
@@ -965,7 +1363,7 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                 }
             }
         }
-        if(p == 9 || p == 16)
+        if(p == 9 || p == 16 || (p > 16 && Kind[0][p] == 4))
         {
             for(int i = 1; i < 8-p_r; i++)  // N
             {
@@ -1000,8 +1398,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < p_r+1; i++)  // S
@@ -1037,8 +1435,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < 8-p_f; i++)  // E
@@ -1074,8 +1472,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < p_f+1; i++)  // W
@@ -1111,12 +1509,12 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
         }
-        if(p == 10 || p == 15)
+        if(p == 10 || p == 15 || (p > 16 && Kind[0][p] == 2))
         {
             if(p_r < 7 && p_f < 6)  // Kn_1
             {
@@ -1271,7 +1669,7 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                 }
             }
         }
-        if(p == 11 || p == 14)
+        if(p == 11 || p == 14 || (p > 16 && Kind[0][p] == 3))
         {
             for(int i = 1; i < min(8-p_r, 8-p_f); i++)  // NE
             {
@@ -1306,8 +1704,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(8-p_r, p_f+1); i++)  // NW
@@ -1343,8 +1741,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(p_r+1, p_f+1); i++)  // SW
@@ -1380,8 +1778,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(p_r+1, 8-p_f); i++)  // SE
@@ -1417,12 +1815,12 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
         }
-        if(p == 12 || p > 16)
+        if(p == 12 || (p > 16 && Kind[0][p] == 5))
         {
             for(int i = 1; i < 8-p_r; i++)  // N
             {
@@ -1457,8 +1855,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < p_r+1; i++)  // S
@@ -1494,8 +1892,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < 8-p_f; i++)  // E
@@ -1531,8 +1929,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < p_f+1; i++)  // W
@@ -1568,8 +1966,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(8-p_r, 8-p_f); i++)  // NE
@@ -1605,8 +2003,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(8-p_r, p_f+1); i++)  // NW
@@ -1642,8 +2040,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(p_r+1, p_f+1); i++)  // SW
@@ -1679,8 +2077,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(p_r+1, 8-p_f); i++)  // SE
@@ -1716,8 +2114,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
         }
@@ -1883,21 +2281,21 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
         
         if(p > -9)
         {
-            if(p_r == 6)
+            if(Board[p_r-1][p_f] == 0)
             {
-                if(Board[p_r-1][p_f] == 0)
+                if(Legal(0, p, p_r, p_f, p_r-1, p_f))
+                {
+                    MoveStack[LM][0] = 0;
+                    MoveStack[LM][1] = p;
+                    MoveStack[LM][2] = p_r;
+                    MoveStack[LM][3] = p_f;
+                    MoveStack[LM][4] = p_r-1;
+                    MoveStack[LM][5] = p_f;
+                    
+                    LM += 1;
+                }
+                if(p_r == 6)
                 {
-                    if(Legal(0, p, p_r, p_f, p_r-1, p_f))
-                    {
-                        MoveStack[LM][0] = 0;
-                        MoveStack[LM][1] = p;
-                        MoveStack[LM][2] = p_r;
-                        MoveStack[LM][3] = p_f;
-                        MoveStack[LM][4] = p_r-1;
-                        MoveStack[LM][5] = p_f;
-                        
-                        LM += 1;
-                    }
                     if(Board[p_r-2][p_f] == 0)
                     {
                         if(Legal(0, p, p_r, p_f, p_r-2, p_f))
@@ -1980,7 +2378,7 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                 }
             }
         }
-        if(p == -9 || p == -16)
+        if(p == -9 || p == -16 || (p < -16 && Kind[1][-p] == 4))
         {
             for(int i = 1; i < 8-p_r; i++)  // N
             {
@@ -2015,8 +2413,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < p_r+1; i++)  // S
@@ -2052,8 +2450,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < 8-p_f; i++)  // E
@@ -2089,8 +2487,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < p_f+1; i++)  // W
@@ -2126,12 +2524,12 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
         }
-        if(p == -10 || p == -15)
+        if(p == -10 || p == -15 || (p < -16 && Kind[1][-p] == 2))
         {
             if(p_r < 7 && p_f < 6)  // Kn_1
             {
@@ -2286,7 +2684,7 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                 }
             }
         }
-        if(p == -11 || p == -14)
+        if(p == -11 || p == -14 || (p < -16 && Kind[1][-p] == 3))
         {
             for(int i = 1; i < min(8-p_r, 8-p_f); i++)  // NE
             {
@@ -2321,8 +2719,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(8-p_r, p_f+1); i++)  // NW
@@ -2358,8 +2756,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(p_r+1, p_f+1); i++)  // SW
@@ -2395,8 +2793,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(p_r+1, 8-p_f); i++)  // SE
@@ -2432,12 +2830,12 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
         }
-        if(p == -12 || p < -16)
+        if(p == -12 || (p < -16 && Kind[1][-p] == 5))
         {
             for(int i = 1; i < 8-p_r; i++)  // N
             {
@@ -2472,8 +2870,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < p_r+1; i++)  // S
@@ -2509,8 +2907,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < 8-p_f; i++)  // E
@@ -2546,8 +2944,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < p_f+1; i++)  // W
@@ -2583,8 +2981,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(8-p_r, 8-p_f); i++)  // NE
@@ -2620,8 +3018,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(8-p_r, p_f+1); i++)  // NW
@@ -2657,8 +3055,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(p_r+1, p_f+1); i++)  // SW
@@ -2694,8 +3092,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f-i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
             for(int i = 1; i < min(p_r+1, 8-p_f); i++)  // SE
@@ -2731,8 +3129,8 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
                         MoveStack[LM][5] = p_f+i;
                         
                         LM += 1;
-                        break;
                     }
+                    break;   // Can't go past the enemy piece, even if taking it isn't legal
                 }
             }
         }
@@ -2895,10 +3293,15 @@ int LegalMoves(int p, int p_r, int p_f, int LM)
     return LM;
 }
 
-int Promotion(int type, int arg0, int arg1, int arg2, int arg3, int arg4, int nQueens)
+int Promotion(int type, int arg0, int arg1, int arg2, int arg3, int arg4, int nQueens)   // Type 0 promotes to a queen, 4 knight, 5 bishop, 6 rook
 {
-    if(type == 0)
+    (void)arg1;   // Same arguments as Move: the origin square isn't needed
+    (void)arg2;
+    
+    if(type == 0 || type >= 4)
     {
+        int kind = type == 0 ? 5 : type - 2;
+        
         if(arg0 > 0 && arg0 < 9)
         {
             if(arg3 == 7)
@@ -2913,6 +3316,11 @@ int Promotion(int type, int arg0, int arg1, int arg2, int arg3, int arg4, int nQ
                 Pieces[0][newQueen][0] = 7;
                 Pieces[0][newQueen][1] = arg4;
                 
+                Kind[0][newQueen] = kind;
+                
+                Toggle(0, 1, 56 + arg4);
+                Toggle(0, kind, 56 + arg4);
+                
                 return 1;
             }
         }
@@ -2930,6 +3338,11 @@ int Promotion(int type, int arg0, int arg1, int arg2, int arg3, int arg4, int nQ
                 Pieces[1][newQueen][0] = 0;
                 Pieces[1][newQueen][1] = arg4;
                 
+                Kind[1][newQueen] = kind;
+                
+                Toggle(1, 1, arg4);
+                Toggle(1, kind, arg4);
+                
                 return 1;
             }
         }
@@ -2937,24 +3350,30 @@ int Promotion(int type, int arg0, int arg1, int arg2, int arg3, int arg4, int nQ
     return 0;
 }
 
-int Play(int rounds)
+int Underpromotions(int start, int LM)   // For every pawn move to the last rank in MoveStack[start..LM), adds the knight, bishop and rook promotions
 {
-    int type;
-    int arg0;
-    int arg1;
-    int arg2;
-    int arg3;
-    int arg4;
-    
-    int LM;   // Legal moves
-    int rm;   // Random move
-    
-    int Last_Move[6];
+    int end = LM;
     
-    for(int round = 1; round <= rounds; round++)
+    for(int i = start; i < end; i++)
+    {
+        if(MoveStack[i][4] == 7 || MoveStack[i][4] == 0)
+        {
+            for(int type = 4; type <= 6; type++)
+            {
+                memcpy(MoveStack[LM], MoveStack[i], sizeof(MoveStack[i]));
+                MoveStack[LM][0] = type;
+                
+                LM += 1;
+            }
+        }
+    }
+    return LM;
+}
+
+int Generate_Moves(int team, int LM)   // Pushes every legal move of a team into MoveStack, starting at LM
+{
+    if(team == 0)
     {
-        LM = 0;
-        
         for(int p = 1; p < 25; p++)   // Normal moves
         {
             int p_r = Pieces[0][p][0];
@@ -2962,7 +3381,11 @@ int Play(int rounds)
             
             if(p_r != 8)
             {
+                int start = LM;
+                
                 LM = LegalMoves(p, p_r, p_f, LM);
+                
+                if(p < 9 && p_r == 6){LM = Underpromotions(start, LM);}
             }
         }
         
@@ -3021,47 +3444,9 @@ int Play(int rounds)
                 }
             }
         }
-        
-        if(LM == 0){return 1;}
-        
-        rm = rand() % LM;   // Random move
-        
-        type = MoveStack[rm][0];
-        arg0 = MoveStack[rm][1];
-        arg1 = MoveStack[rm][2];
-        arg2 = MoveStack[rm][3];
-        arg3 = MoveStack[rm][4];
-        arg4 = MoveStack[rm][5];
-        
-        Move(type, arg0, arg1, arg2, arg3, arg4);
-        
-        Last_Move[0] = type;
-        Last_Move[1] = arg0;
-        Last_Move[2] = arg1;
-        Last_Move[3] = arg2;
-        Last_Move[4] = arg3;
-        Last_Move[5] = arg4;
-        
-        if(Promotion(type, arg0, arg1, arg2, arg3, arg4, PQueens_W))
-        {
-            PQueens_W += 1;
-        }
-        
-        if(QCastle_W || KCastle_W)
-        {
-            if(arg0 == 13 || type == 1 || type == 2)
-            {
-                QCastle_W = 0;
-                KCastle_W = 0;
-            }
-            else if(arg0 == 9){QCastle_W = 0;}
-            else if(arg0 == 16){KCastle_W = 0;}
-        }
-        
-        ///////////////////////////////////////////////////////////////////////////////////
-
-        LM = 0;
-        
+    }
+    else
+    {
         for(int p = -1; p > -25; p--)
         {
             int p_r = Pieces[1][-p][0];
@@ -3069,7 +3454,11 @@ int Play(int rounds)
             
             if(p_r != 8)
             {
+                int start = LM;
+                
                 LM = LegalMoves(p, p_r, p_f, LM);
+                
+                if(p > -9 && p_r == 1){LM = Underpromotions(start, LM);}
             }
         }
         
@@ -3102,7 +3491,7 @@ int Play(int rounds)
             }
         }
         
-        if(Last_Move[0] == 0 && Last_Move[1] < 9 && Last_Move[2] == 1 && Last_Move[4] == 3)
+        if(Last_Move[0] == 0 && Last_Move[1] > 0 && Last_Move[1] < 9 && Last_Move[2] == 1 && Last_Move[4] == 3)
         {
             for(int p = -1; p > -9; p--)
             {
@@ -3128,28 +3517,66 @@ int Play(int rounds)
                 }
             }
         }
-        
-        if(LM == 0){return 0;}
+    }
+    return LM;
+}
 
-        rm = rand() % LM;
-        
-        type = MoveStack[rm][0];
-        arg0 = MoveStack[rm][1];
-        arg1 = MoveStack[rm][2];
-        arg2 = MoveStack[rm][3];
-        arg3 = MoveStack[rm][4];
-        arg4 = MoveStack[rm][5];
-        
-        Move(type, arg0, arg1, arg2, arg3, arg4);
-        
-        Last_Move[0] = type;
-        Last_Move[1] = arg0;
-        Last_Move[2] = arg1;
-        Last_Move[3] = arg2;
-        Last_Move[4] = arg3;
-        Last_Move[5] = arg4;
-        
-        if(Promotion(type, arg0, arg1, arg2, arg3, arg4, PQueens_B))
+void Make_Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4, Undo *u)   // Move, plus promotion, castling rights and Last_Move
+{
+    if(type == 0 || type >= 4){u->captured = Board[arg3][arg4];}
+    else if(type == 3){u->captured = Board[arg1][arg4];}   // The falling pawn stands beside the moving one
+    else{u->captured = 0;}
+    
+    u->castle[0] = QCastle_W;
+    u->castle[1] = KCastle_W;
+    u->castle[2] = QCastle_B;
+    u->castle[3] = KCastle_B;
+    u->pqueens[0] = PQueens_W;
+    u->pqueens[1] = PQueens_B;
+    memcpy(u->last_move, Last_Move, sizeof(Last_Move));
+    u->hash = Hash;
+    memcpy(u->bitboards, Bitboards, sizeof(Bitboards));
+    memcpy(u->mg, MG_Score, sizeof(MG_Score));
+    memcpy(u->eg, EG_Score, sizeof(EG_Score));
+    u->phase = Phase;
+    u->pawn_hash = Pawn_Hash;
+    u->acc_top = NNUE_Loaded ? NNUE_Push() : 0;
+    
+    Hash ^= State_Hash();
+    
+    Move(type, arg0, arg1, arg2, arg3, arg4);
+    
+    Last_Move[0] = type;
+    Last_Move[1] = arg0;
+    Last_Move[2] = arg1;
+    Last_Move[3] = arg2;
+    Last_Move[4] = arg3;
+    Last_Move[5] = arg4;
+    
+    if((type == 1 || type == 2) ? arg0 == 0 : arg0 > 0)   // White moved
+    {
+        if(Promotion(type, arg0, arg1, arg2, arg3, arg4, PQueens_W))
+        {
+            PQueens_W += 1;
+        }
+        
+        if(QCastle_W || KCastle_W)
+        {
+            if(arg0 == 13 || type == 1 || type == 2)
+            {
+                QCastle_W = 0;
+                KCastle_W = 0;
+            }
+            else if(arg0 == 9){QCastle_W = 0;}
+            else if(arg0 == 16){KCastle_W = 0;}
+        }
+        
+        if(u->captured == -9){QCastle_B = 0;}   // A rook taken at home can't castle any more
+        if(u->captured == -16){KCastle_B = 0;}
+    }
+    else
+    {
+        if(Promotion(type, arg0, arg1, arg2, arg3, arg4, PQueens_B))
         {
             PQueens_B += 1;
         }
@@ -3164,12 +3591,4569 @@ int Play(int rounds)
             else if(arg0 == -9){QCastle_B = 0;}
             else if(arg0 == -16){KCastle_B = 0;}
         }
+        
+        if(u->captured == 9){QCastle_W = 0;}
+        if(u->captured == 16){KCastle_W = 0;}
+    }
+    
+    Hash ^= State_Hash() ^ Zobrist_Side;
+}
+
+void Unmake_Move(int type, int arg0, int arg1, int arg2, int arg3, int arg4, Undo *u)   // Takes back a Make_Move
+{
+    if(type != 1 && type != 2)
+    {
+        int t = arg0 < 0;                  // Team
+        int mp = t == 0 ? arg0 : -arg0;    // Moving piece ID
+        
+        if(type != 3 && mp < 9 && (arg3 == 7 || arg3 == 0))   // Promoted: take the new piece away
+        {
+            int newQueen = 17 + u->pqueens[t];
+            
+            Pieces[t][newQueen][0] = 8;
+            Pieces[t][newQueen][1] = 8;
+        }
+        
+        Board[arg1][arg2] = arg0;
+        Pieces[t][mp][0] = arg1;
+        Pieces[t][mp][1] = arg2;
+        
+        if(type != 3)
+        {
+            Board[arg3][arg4] = u->captured;
+            
+            if(u->captured != 0)
+            {
+                Pieces[1-t][t == 0 ? -u->captured : u->captured][0] = arg3;
+                Pieces[1-t][t == 0 ? -u->captured : u->captured][1] = arg4;
+            }
+        }
+        else
+        {
+            Board[arg3][arg4] = 0;
+            Board[arg1][arg4] = u->captured;
+            
+            Pieces[1-t][t == 0 ? -u->captured : u->captured][0] = arg1;
+            Pieces[1-t][t == 0 ? -u->captured : u->captured][1] = arg4;
+        }
+    }
+    else
+    {
+        int t = arg0;
+        int r = t == 0 ? 0 : 7;
+        int s = t == 0 ? 1 : -1;   // Sign of this team's pieces
+        
+        if(type == 1)
+        {
+            Board[r][0] = 9*s;
+            Board[r][2] = 0;
+            Board[r][3] = 0;
+            
+            Pieces[t][9][1] = 0;
+        }
+        else
+        {
+            Board[r][5] = 0;
+            Board[r][6] = 0;
+            Board[r][7] = 16*s;
+            
+            Pieces[t][16][1] = 7;
+        }
+        Board[r][4] = 13*s;
+        
+        Pieces[t][13][1] = 4;
+    }
+    
+    QCastle_W = u->castle[0];
+    KCastle_W = u->castle[1];
+    QCastle_B = u->castle[2];
+    KCastle_B = u->castle[3];
+    PQueens_W = u->pqueens[0];
+    PQueens_B = u->pqueens[1];
+    memcpy(Last_Move, u->last_move, sizeof(Last_Move));
+    Hash = u->hash;
+    memcpy(Bitboards, u->bitboards, sizeof(Bitboards));
+    memcpy(MG_Score, u->mg, sizeof(MG_Score));
+    memcpy(EG_Score, u->eg, sizeof(EG_Score));
+    Phase = u->phase;
+    Pawn_Hash = u->pawn_hash;
+    if(NNUE_Loaded){NNUE_Pop(u->acc_top);}
+}
+
+// Bitboard move generator. Same moves and MoveStack layout as Generate_Moves, but found from attack
+// sets: pinned pieces and checkers are worked out once per position, so no move needs a Legal call.
+
+unsigned long long Knight_Attacks[64];
+unsigned long long King_Attacks[64];
+unsigned long long Pawn_Attacks[2][64];   // Squares attacked by a pawn of the team standing on the square
+unsigned long long Rays[8][64];           // N, E, NE, NW (towards higher squares), S, W, SW, SE
+unsigned long long Between[64][64];       // Squares strictly between two aligned squares
+unsigned long long Line[64][64];          // The whole line through two aligned squares
+
+int New_Generator = 0;   // Perft uses Bitboard_Moves instead of Generate_Moves
+
+void Init_Bitboards(void)
+{
+    int dr[8] = {1, 0, 1,  1, -1,  0, -1, -1};
+    int df[8] = {0, 1, 1, -1,  0, -1, -1,  1};
+    int kn[8][2] = {{1,2}, {2,1}, {2,-1}, {1,-2}, {-1,-2}, {-2,-1}, {-2,1}, {-1,2}};
+    
+    for(int sq = 0; sq < 64; sq++)
+    {
+        int r = sq / 8;
+        int f = sq % 8;
+        
+        for(int k = 0; k < 8; k++)
+        {
+            int nr = r + kn[k][0];
+            int nf = f + kn[k][1];
+            
+            if(nr >= 0 && nr < 8 && nf >= 0 && nf < 8){Knight_Attacks[sq] |= 1ULL << (nr*8 + nf);}
+            
+            nr = r + dr[k];
+            nf = f + df[k];
+            
+            if(nr >= 0 && nr < 8 && nf >= 0 && nf < 8){King_Attacks[sq] |= 1ULL << (nr*8 + nf);}
+            
+            for(int i = 1; ; i++)
+            {
+                nr = r + i*dr[k];
+                nf = f + i*df[k];
+                
+                if(nr < 0 || nr > 7 || nf < 0 || nf > 7){break;}
+                
+                Rays[k][sq] |= 1ULL << (nr*8 + nf);
+            }
+        }
+        if(r < 7 && f > 0){Pawn_Attacks[0][sq] |= 1ULL << (sq + 7);}
+        if(r < 7 && f < 7){Pawn_Attacks[0][sq] |= 1ULL << (sq + 9);}
+        if(r > 0 && f > 0){Pawn_Attacks[1][sq] |= 1ULL << (sq - 9);}
+        if(r > 0 && f < 7){Pawn_Attacks[1][sq] |= 1ULL << (sq - 7);}
+    }
+    for(int a = 0; a < 64; a++)
+    {
+        for(int d = 0; d < 8; d++)
+        {
+            unsigned long long ray = Rays[d][a];
+            
+            while(ray)
+            {
+                int b = __builtin_ctzll(ray);
+                
+                ray &= ray - 1;
+                
+                Between[a][b] = Rays[d][a] & Rays[(d + 4) % 8][b];
+                Line[a][b] = Rays[d][a] | Rays[(d + 4) % 8][a] | 1ULL << a;
+            }
+        }
+    }
+}
+
+unsigned long long Ray_Attacks(int d, int sq, unsigned long long occ)   // Up to and including the first piece in the way
+{
+    unsigned long long a = Rays[d][sq];
+    unsigned long long b = a & occ;
+    
+    if(b)
+    {
+        a ^= Rays[d][d < 4 ? __builtin_ctzll(b) : 63 - __builtin_clzll(b)];
+    }
+    return a;
+}
+
+unsigned long long Rook_Attacks(int sq, unsigned long long occ)
+{
+    return Ray_Attacks(0, sq, occ) | Ray_Attacks(1, sq, occ) | Ray_Attacks(4, sq, occ) | Ray_Attacks(5, sq, occ);
+}
+
+unsigned long long Bishop_Attacks(int sq, unsigned long long occ)
+{
+    return Ray_Attacks(2, sq, occ) | Ray_Attacks(3, sq, occ) | Ray_Attacks(6, sq, occ) | Ray_Attacks(7, sq, occ);
+}
+
+unsigned long long Attackers_To(int sq, int by, unsigned long long occ)   // Pieces of team by (among occ) attacking sq
+{
+    unsigned long long *b = Bitboards[by];
+    
+    return ((Pawn_Attacks[1-by][sq] & b[1]) | (Knight_Attacks[sq] & b[2]) | (King_Attacks[sq] & b[6])
+          | (Bishop_Attacks(sq, occ) & (b[3] | b[5])) | (Rook_Attacks(sq, occ) & (b[4] | b[5]))) & occ;
+}
+
+// Static Exchange Evaluation: the material a capture wins (or loses) once both teams have traded
+// every attacker of the square, least valuable first. Only bitboards are used, nothing is moved:
+// each piece taken out of the occupancy lets the sliders behind it (x-rays) join in. Pins are ignored.
+
+int SEE(int *m)
+{
+    int from = m[2]*8 + m[3];
+    int to = m[4]*8 + m[5];
+    int team = m[1] > 0 || ((m[0] == 1 || m[0] == 2) && m[1] == 0) ? 0 : 1;
+    int bp = Board[m[4]][m[5]];
+    int gain[32];
+    int d = 0;
+    unsigned long long occ = Bitboards[0][0] | Bitboards[1][0];
+    unsigned long long sliders_d = Bitboards[0][3] | Bitboards[0][5] | Bitboards[1][3] | Bitboards[1][5];
+    unsigned long long sliders_o = Bitboards[0][4] | Bitboards[0][5] | Bitboards[1][4] | Bitboards[1][5];
+    int attacker = m[1] > 0 ? Kind[0][m[1]] : Kind[1][-m[1]];
+    
+    if(m[0] == 1 || m[0] == 2){return 0;}
+    
+    gain[0] = m[0] == 3 ? Piece_Value[1] : bp > 0 ? Piece_Value[Kind[0][bp]] : bp < 0 ? Piece_Value[Kind[1][-bp]] : 0;
+    
+    if(m[0] == 3){occ ^= 1ULL << (m[2]*8 + m[5]);}   // The pawn taken En Passant isn't on the square
+    
+    unsigned long long attackers = Attackers_To(to, 0, occ) | Attackers_To(to, 1, occ);
+    unsigned long long from_set = 1ULL << from;
+    int side = team;
+    
+    while(from_set)
+    {
+        d += 1;
+        gain[d] = Piece_Value[attacker] - gain[d-1];   // Balance for the other side if it takes this attacker back
+        
+        attackers ^= from_set;
+        occ ^= from_set;
+        attackers |= ((Bishop_Attacks(to, occ) & sliders_d) | (Rook_Attacks(to, occ) & sliders_o)) & occ;
+        
+        side = 1 - side;
+        from_set = 0;
+        
+        for(int k = 1; k <= 6; k++)   // Least valuable attacker of the side to capture
+        {
+            unsigned long long b = attackers & Bitboards[side][k];
+            
+            if(b)
+            {
+                from_set = b & -b;
+                attacker = k;
+                break;
+            }
+        }
+        
+        if(d == 31){break;}
+    }
+    
+    while(--d > 0)
+    {
+        gain[d-1] = -(-gain[d-1] > gain[d] ? -gain[d-1] : gain[d]);
+    }
+    return gain[0];
+}
+
+int Push_Move(int LM, int type, int from, int to)
+{
+    MoveStack[LM][0] = type;
+    MoveStack[LM][1] = Board[from / 8][from % 8];
+    MoveStack[LM][2] = from / 8;
+    MoveStack[LM][3] = from % 8;
+    MoveStack[LM][4] = to / 8;
+    MoveStack[LM][5] = to % 8;
+    
+    return LM + 1;
+}
+
+int Bitboard_Generate(int team, int LM, int captures)   // With captures set, only captures and queen promotions are made
+{
+    int e = 1 - team;   // Enemy
+    unsigned long long own = Bitboards[team][0];
+    unsigned long long occ = own | Bitboards[e][0];
+    int ksq = __builtin_ctzll(Bitboards[team][6]);
+    unsigned long long checkers = Attackers_To(ksq, e, occ);
+    unsigned long long a;
+    
+    a = King_Attacks[ksq] & (captures ? Bitboards[e][0] : ~own);
+    
+    while(a)
+    {
+        int to = __builtin_ctzll(a);
+        
+        a &= a - 1;
+        
+        if(!Attackers_To(to, e, occ ^ 1ULL << ksq)){LM = Push_Move(LM, 0, ksq, to);}
+    }
+    
+    if(checkers & (checkers - 1)){return LM;}   // Double check: only the king can move
+    
+    unsigned long long target = ~own;   // Where the other pieces may go
+    
+    if(checkers){target = Between[ksq][__builtin_ctzll(checkers)] | checkers;}
+    
+    unsigned long long pawn_target = target;
+    
+    if(captures)   // Pawns may also push to the last rank
+    {
+        pawn_target &= Bitboards[e][0] | (team == 0 ? 0xFFULL << 56 : 0xFFULL);
+        target &= Bitboards[e][0];
+    }
+    
+    unsigned long long pinned = 0;
+    unsigned long long snipers = (Rook_Attacks(ksq, 0) & (Bitboards[e][4] | Bitboards[e][5])) | (Bishop_Attacks(ksq, 0) & (Bitboards[e][3] | Bitboards[e][5]));
+    
+    while(snipers)
+    {
+        unsigned long long b = Between[ksq][__builtin_ctzll(snipers)] & occ;
+        
+        snipers &= snipers - 1;
+        
+        if(b && !(b & (b - 1)) && (b & own)){pinned |= b;}
+    }
+    
+    for(int k = 2; k <= 5; k++)   // Knights, bishops, rooks and queens
+    {
+        unsigned long long pieces = Bitboards[team][k];
+        
+        while(pieces)
+        {
+            int from = __builtin_ctzll(pieces);
+            
+            pieces &= pieces - 1;
+            
+            if(k == 2){a = Knight_Attacks[from];}
+            else if(k == 3){a = Bishop_Attacks(from, occ);}
+            else if(k == 4){a = Rook_Attacks(from, occ);}
+            else{a = Bishop_Attacks(from, occ) | Rook_Attacks(from, occ);}
+            
+            a &= target;
+            
+            if(pinned >> from & 1){a &= Line[ksq][from];}
+            
+            while(a)
+            {
+                LM = Push_Move(LM, 0, from, __builtin_ctzll(a));
+                a &= a - 1;
+            }
+        }
+    }
+    
+    int up = team == 0 ? 8 : -8;
+    int start = team == 0 ? 1 : 6;
+    int last = team == 0 ? 7 : 0;
+    unsigned long long pieces = Bitboards[team][1];
+    
+    while(pieces)
+    {
+        int from = __builtin_ctzll(pieces);
+        
+        pieces &= pieces - 1;
+        
+        a = Pawn_Attacks[team][from] & Bitboards[e][0];
+        
+        if(!(occ >> (from + up) & 1))
+        {
+            a |= 1ULL << (from + up);
+            
+            if(from / 8 == start && !(occ >> (from + 2*up) & 1)){a |= 1ULL << (from + 2*up);}
+        }
+        
+        a &= pawn_target;
+        
+        if(pinned >> from & 1){a &= Line[ksq][from];}
+        
+        while(a)
+        {
+            int to = __builtin_ctzll(a);
+            
+            a &= a - 1;
+            
+            LM = Push_Move(LM, 0, from, to);
+            
+            if(to / 8 == last && !captures)
+            {
+                LM = Push_Move(LM, 4, from, to);
+                LM = Push_Move(LM, 5, from, to);
+                LM = Push_Move(LM, 6, from, to);
+            }
+        }
+    }
+    
+    // En Passant: rare enough to check the king's safety with the board as it would be after the capture
+    
+    if(Last_Move[0] == 0 && (team == 0 ? Last_Move[1] < 0 && Last_Move[1] > -9 : Last_Move[1] > 0 && Last_Move[1] < 9)
+       && (Last_Move[4] - Last_Move[2] == 2 || Last_Move[2] - Last_Move[4] == 2))
+    {
+        int cap = Last_Move[4]*8 + Last_Move[5];
+        int to = cap + up;
+        
+        a = Pawn_Attacks[e][to] & Bitboards[team][1];
+        
+        while(a)
+        {
+            int from = __builtin_ctzll(a);
+            
+            a &= a - 1;
+            
+            if(!Attackers_To(ksq, e, occ ^ 1ULL << from ^ 1ULL << to ^ 1ULL << cap)){LM = Push_Move(LM, 3, from, to);}
+        }
+    }
+    
+    if(!checkers && !captures)
+    {
+        int r = team == 0 ? 0 : 7;
+        int s = team == 0 ? 1 : -1;
+        
+        if((team == 0 ? QCastle_W : QCastle_B) && Board[r][0] == 9*s && Board[r][4] == 13*s && !(occ & 7ULL << (r*8 + 1))
+           && !Attackers_To(r*8 + 3, e, occ) && !Attackers_To(r*8 + 2, e, occ))
+        {
+            MoveStack[LM][0] = 1;
+            MoveStack[LM][1] = team;
+            MoveStack[LM][2] = 0;
+            MoveStack[LM][3] = 0;
+            MoveStack[LM][4] = 0;
+            MoveStack[LM][5] = 0;
+            
+            LM += 1;
+        }
+        if((team == 0 ? KCastle_W : KCastle_B) && Board[r][7] == 16*s && Board[r][4] == 13*s && !(occ & 3ULL << (r*8 + 5))
+           && !Attackers_To(r*8 + 5, e, occ) && !Attackers_To(r*8 + 6, e, occ))
+        {
+            MoveStack[LM][0] = 2;
+            MoveStack[LM][1] = team;
+            MoveStack[LM][2] = 0;
+            MoveStack[LM][3] = 0;
+            MoveStack[LM][4] = 0;
+            MoveStack[LM][5] = 0;
+            
+            LM += 1;
+        }
+    }
+    return LM;
+}
+
+int Bitboard_Moves(int team, int LM)   // Pushes every legal move of a team into MoveStack, starting at LM
+{
+    return Bitboard_Generate(team, LM, 0);
+}
+
+int Bitboard_Captures(int team, int LM)   // Only the captures (En Passant included) and queen promotions, for quiescence
+{
+    return Bitboard_Generate(team, LM, 1);
+}
+
+int Generate(int team, int LM)   // The move generator perft is measuring
+{
+    if(New_Generator){return Bitboard_Moves(team, LM);}
+    
+    return Generate_Moves(team, LM);
+}
+
+int Avoid_Losing_Captures = 0;   // Playout policy: no random capture that SEE says loses material, unless there is nothing else
+
+int Play(int rounds, int team)   // Plays random moves, starting with team. Returns the winning team, or -1 (stalemate, or no result after rounds)
+{
+    int LM;   // Legal moves
+    int rm;   // Random move
+    Undo u;
+    
+    for(int ply = 0; ply < 2*rounds; ply++)
+    {
+        LM = Generate_Moves(team, 0);
+        
+        if(LM == 0)
+        {
+            if(Check(team)){return 1 - team;}
+            return -1;
+        }
+        
+        if(Avoid_Losing_Captures)
+        {
+            int n = 0;
+            
+            for(int i = 0; i < LM; i++)
+            {
+                int *m = MoveStack[i];
+                
+                if((m[0] == 3 || (m[0] != 1 && m[0] != 2 && Board[m[4]][m[5]] != 0)) && SEE(m) < 0){continue;}
+                
+                if(n != i){memcpy(MoveStack[n], m, sizeof(MoveStack[n]));}
+                n += 1;
+            }
+            if(n > 0){LM = n;}   // With n == 0 nothing was overwritten
+        }
+        
+        rm = Random() % LM;   // Random move
+        
+        Make_Move(MoveStack[rm][0], MoveStack[rm][1], MoveStack[rm][2], MoveStack[rm][3], MoveStack[rm][4], MoveStack[rm][5], &u);
+        
+        team = 1 - team;
     }
     
     return -1;
 }
 
-int main()
+int Load_FEN(const char *fen)   // Sets up the game state from a FEN (or EPD) line. Returns the team to move, or -1 if the line can't be used
 {
-    Play(100);
+    char sq[8][8];   // Piece letters, before IDs are given
+    int r = 7;
+    int f = 0;
+    
+    memset(sq, 0, sizeof(sq));
+    
+    while(*fen == ' '){fen++;}
+    
+    for(; *fen && *fen != ' '; fen++)
+    {
+        if(*fen == '/'){r -= 1; f = 0;}
+        else if(*fen >= '1' && *fen <= '8'){f += *fen - '0';}
+        else
+        {
+            if(r < 0 || f > 7 || strchr("PNBRQKpnbrqk", *fen) == NULL){return -1;}
+            sq[r][f] = *fen;
+            f += 1;
+        }
+    }
+    
+    while(*fen == ' '){fen++;}
+    
+    int team;
+    
+    if(*fen == 'w'){team = 0;}
+    else if(*fen == 'b'){team = 1;}
+    else{return -1;}
+    fen++;
+    
+    while(*fen == ' '){fen++;}
+    
+    QCastle_W = 0; KCastle_W = 0;
+    QCastle_B = 0; KCastle_B = 0;
+    
+    for(; *fen && *fen != ' '; fen++)
+    {
+        if(*fen == 'K'){KCastle_W = 1;}
+        if(*fen == 'Q'){QCastle_W = 1;}
+        if(*fen == 'k'){KCastle_B = 1;}
+        if(*fen == 'q'){QCastle_B = 1;}
+    }
+    
+    while(*fen == ' '){fen++;}
+    
+    int ep_f = -1;   // En Passant file
+    
+    if(*fen >= 'a' && *fen <= 'h'){ep_f = *fen - 'a';}
+    
+    for(int i = 0; i < 8; i++)
+    {
+        for(int j = 0; j < 8; j++)
+        {
+            Board[i][j] = 0;
+        }
+    }
+    for(int t = 0; t < 2; t++)
+    {
+        for(int p = 0; p < 25; p++)
+        {
+            Pieces[t][p][0] = 8;
+            Pieces[t][p][1] = 8;
+        }
+    }
+    PQueens_W = 0;
+    PQueens_B = 0;
+    
+    // Castling needs rook 9 on the queen side corner and rook 16 on the king side corner, so those go first
+    
+    if(sq[0][0] == 'R' && QCastle_W){Board[0][0] = 9;  Pieces[0][9][0] = 0;  Pieces[0][9][1] = 0;}
+    if(sq[0][7] == 'R' && KCastle_W){Board[0][7] = 16; Pieces[0][16][0] = 0; Pieces[0][16][1] = 7;}
+    if(sq[7][0] == 'r' && QCastle_B){Board[7][0] = -9;  Pieces[1][9][0] = 7;  Pieces[1][9][1] = 0;}
+    if(sq[7][7] == 'r' && KCastle_B){Board[7][7] = -16; Pieces[1][16][0] = 7; Pieces[1][16][1] = 7;}
+    
+    for(int i = 0; i < 8; i++)
+    {
+        for(int j = 0; j < 8; j++)
+        {
+            char c = sq[i][j];
+            
+            if(c == 0 || Board[i][j] != 0){continue;}
+            
+            int t = (c >= 'a');   // Team
+            int ids[10];          // Candidate IDs for this piece
+            int n = 0;
+            int kind = 0;
+            
+            if(c == 'P' || c == 'p'){for(int p = 1; p < 9; p++){ids[n++] = p;}}
+            if(c == 'R' || c == 'r'){ids[n++] = 9;  ids[n++] = 16; kind = 4;}
+            if(c == 'N' || c == 'n'){ids[n++] = 10; ids[n++] = 15; kind = 2;}
+            if(c == 'B' || c == 'b'){ids[n++] = 11; ids[n++] = 14; kind = 3;}
+            if(c == 'Q' || c == 'q'){ids[n++] = 12; kind = 5;}
+            if(c == 'K' || c == 'k'){ids[n++] = 13;}
+            
+            if(kind != 0){for(int p = 17; p < 25; p++){ids[n++] = p;}}   // Extra pieces take promoted IDs
+            
+            int id = 0;
+            
+            for(int k = 0; k < n; k++)
+            {
+                if(Pieces[t][ids[k]][0] == 8){id = ids[k]; break;}
+            }
+            if(id == 0){return -1;}   // More pieces of a kind than there are IDs for it
+            
+            if(id > 16)
+            {
+                Kind[t][id] = kind;
+                
+                if(t == 0){PQueens_W += 1;}
+                else{PQueens_B += 1;}
+            }
+            
+            Board[i][j] = t == 0 ? id : -id;
+            Pieces[t][id][0] = i;
+            Pieces[t][id][1] = j;
+        }
+    }
+    
+    if(Pieces[0][13][0] == 8 || Pieces[1][13][0] == 8){return -1;}
+    
+    // Castling rights without the king and rook at home can't be used
+    
+    if(Board[0][4] != 13 || Board[0][0] != 9){QCastle_W = 0;}
+    if(Board[0][4] != 13 || Board[0][7] != 16){KCastle_W = 0;}
+    if(Board[7][4] != -13 || Board[7][0] != -9){QCastle_B = 0;}
+    if(Board[7][4] != -13 || Board[7][7] != -16){KCastle_B = 0;}
+    
+    // En Passant is found by looking at the last move, so the double pawn push is rebuilt
+    
+    Last_Move[0] = -1;
+    
+    if(ep_f != -1)
+    {
+        if(team == 1 && Board[3][ep_f] > 0 && Board[3][ep_f] < 9)
+        {
+            Last_Move[0] = 0;
+            Last_Move[1] = Board[3][ep_f];
+            Last_Move[2] = 1;
+            Last_Move[3] = ep_f;
+            Last_Move[4] = 3;
+            Last_Move[5] = ep_f;
+        }
+        if(team == 0 && Board[4][ep_f] < 0 && Board[4][ep_f] > -9)
+        {
+            Last_Move[0] = 0;
+            Last_Move[1] = Board[4][ep_f];
+            Last_Move[2] = 6;
+            Last_Move[3] = ep_f;
+            Last_Move[4] = 4;
+            Last_Move[5] = ep_f;
+        }
+    }
+    
+    Hash = Compute_Hash(team);
+    
+    memset(Bitboards, 0, sizeof(Bitboards));
+    
+    for(int t = 0; t < 2; t++)
+    {
+        for(int p = 1; p < 25; p++)
+        {
+            if(Pieces[t][p][0] != 8)
+            {
+                Bitboards[t][Kind[t][p]] |= 1ULL << (Pieces[t][p][0]*8 + Pieces[t][p][1]);
+                Bitboards[t][0] |= 1ULL << (Pieces[t][p][0]*8 + Pieces[t][p][1]);
+            }
+        }
+    }
+    Compute_Eval();
+    NNUE_Reset();
+    
+    return team;
+}
+
+void Write_FEN(int team, char *s)   // The game state as a FEN line (halfmove and fullmove counters are not kept: "0 1")
+{
+    const char *letters = " PNBRQK";
+    
+    for(int i = 7; i >= 0; i--)
+    {
+        int empty = 0;
+        
+        for(int j = 0; j < 8; j++)
+        {
+            int p = Board[i][j];
+            
+            if(p == 0){empty += 1; continue;}
+            if(empty > 0){*s++ = '0' + empty; empty = 0;}
+            
+            char c = letters[p > 0 ? Kind[0][p] : Kind[1][-p]];
+            
+            *s++ = p > 0 ? c : c - 'A' + 'a';
+        }
+        if(empty > 0){*s++ = '0' + empty;}
+        if(i > 0){*s++ = '/';}
+    }
+    
+    *s++ = ' ';
+    *s++ = team == 0 ? 'w' : 'b';
+    *s++ = ' ';
+    
+    char *castle = s;
+    
+    if(KCastle_W && Board[0][4] == 13 && Board[0][7] == 16){*s++ = 'K';}
+    if(QCastle_W && Board[0][4] == 13 && Board[0][0] == 9){*s++ = 'Q';}
+    if(KCastle_B && Board[7][4] == -13 && Board[7][7] == -16){*s++ = 'k';}
+    if(QCastle_B && Board[7][4] == -13 && Board[7][0] == -9){*s++ = 'q';}
+    if(s == castle){*s++ = '-';}
+    
+    *s++ = ' ';
+    
+    if(Last_Move[0] == 0 && Last_Move[1] > -9 && Last_Move[1] < 9 && (Last_Move[4] - Last_Move[2] == 2 || Last_Move[2] - Last_Move[4] == 2))
+    {
+        *s++ = 'a' + Last_Move[5];
+        *s++ = '1' + (Last_Move[2] + Last_Move[4]) / 2;
+    }
+    else{*s++ = '-';}
+    
+    strcpy(s, " 0 1");
+}
+
+// Perft: counts the leaf nodes of the legal move tree. The standard move generator benchmark,
+// and the way to tell whether Check, Legal and LegalMoves are still right after a change.
+
+void Move_Name(int *m, int team, char *s)   // Coordinate notation (e2e4, e1g1, e7e8q)
+{
+    int r = team == 0 ? 0 : 7;
+    
+    if(m[0] == 1){sprintf(s, "e%dc%d", r+1, r+1); return;}
+    if(m[0] == 2){sprintf(s, "e%dg%d", r+1, r+1); return;}
+    
+    int mp = m[1] > 0 ? m[1] : -m[1];
+    
+    const char *promotion = "";
+    
+    if(m[0] != 3 && mp < 9 && (m[4] == 7 || m[4] == 0)){promotion = m[0] == 0 ? "q" : m[0] == 4 ? "n" : m[0] == 5 ? "b" : "r";}
+    
+    sprintf(s, "%c%d%c%d%s", 'a' + m[3], m[2]+1, 'a' + m[5], m[4]+1, promotion);
+}
+
+int Move_Key(int *m)   // A MoveStack row packed in one int (never 0), to sort, compare and store moves
+{
+    return m[0] | (m[1] + 32) << 3 | m[2] << 9 | m[3] << 12 | m[4] << 15 | m[5] << 18;
+}
+
+void Unpack_Move(int key, int *m)
+{
+    m[0] = key & 7;
+    m[1] = (key >> 3 & 63) - 32;
+    m[2] = key >> 9 & 7;
+    m[3] = key >> 12 & 7;
+    m[4] = key >> 15 & 7;
+    m[5] = key >> 18 & 7;
+}
+
+typedef struct
+{
+    unsigned long long key;    // Hash ^ data, so an entry torn by two threads writing at once never matches
+    unsigned long long data;   // nodes << 8 | depth
+} Perft_Entry;
+
+Perft_Entry *Perft_Table = NULL;   // Optional: subtree counts by position hash and depth, shared by all threads without locks
+unsigned long long Perft_Mask;
+
+int Perft_Table_Init(int mb)   // Largest power of two number of entries that fits in mb megabytes. 0 if mb is below 1
+{
+    if(mb < 1){return 0;}
+    
+    unsigned long long n = 1;
+    
+    while(n * 2 * sizeof(Perft_Entry) <= (unsigned long long)mb << 20){n *= 2;}
+    
+    Perft_Table = calloc(n, sizeof(Perft_Entry));
+    
+    if(Perft_Table == NULL){return 0;}
+    
+    Perft_Mask = n - 1;
+    
+    return 1;
+}
+
+long long Perft(int depth, int team, int LM)   // Moves of this ply are generated from MoveStack[LM] on
+{
+    if(depth <= 0){return 1;}
+    
+    Perft_Entry *e = NULL;
+    
+    if(Perft_Table != NULL && depth > 1)
+    {
+        e = &Perft_Table[Hash & Perft_Mask];
+        
+        unsigned long long data = e->data;
+        
+        if((e->key ^ data) == Hash && (int)(data & 255) == depth){return data >> 8;}
+    }
+    
+    long long nodes = 0;
+    int end = Generate(team, LM);
+    
+    if(depth == 1){return end - LM;}   // Bulk counting: the leaves don't need to be played
+    
+    Undo u;
+    
+    for(int i = LM; i < end; i++)
+    {
+        int *m = MoveStack[i];
+        
+        Make_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+        nodes += Perft(depth - 1, 1 - team, end);
+        Unmake_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+    }
+    
+    if(e != NULL)
+    {
+        unsigned long long data = (unsigned long long)nodes << 8 | depth;
+        
+        e->key = Hash ^ data;
+        e->data = data;
+    }
+    return nodes;
+}
+
+// Parallel perft: the tree is split into tasks, one per position two plies down (one ply for
+// shallow trees), so that a root move with a big subtree is shared by several threads.
+
+typedef struct
+{
+    int root;       // Index of the root move, for divide
+    int n;          // Moves to play from the root position (1 or 2)
+    int m[2][6];
+} Perft_Task;
+
+Perft_Task *Tasks;
+int Task_Count;
+atomic_int Next_Task;
+_Atomic long long Root_Nodes[256];
+const char *Task_FEN;
+int Task_Depth;
+
+void *Perft_Worker(void *arg)
+{
+    (void)arg;
+    
+    Undo u[2];
+    
+    while(1)
+    {
+        int i = atomic_fetch_add(&Next_Task, 1);
+        
+        if(i >= Task_Count){break;}
+        
+        Perft_Task *t = &Tasks[i];
+        int team = Load_FEN(Task_FEN);
+        
+        for(int k = 0; k < t->n; k++)
+        {
+            Make_Move(t->m[k][0], t->m[k][1], t->m[k][2], t->m[k][3], t->m[k][4], t->m[k][5], &u[k]);
+            team = 1 - team;
+        }
+        
+        atomic_fetch_add(&Root_Nodes[t->root], Perft(Task_Depth - t->n, team, 0));
+    }
+    return NULL;
+}
+
+long long Parallel_Perft(const char *fen, int depth, int threads, int *roots)   // Fills Root_Nodes, returns the total
+{
+    int team = Load_FEN(fen);
+    int split = depth >= 3 ? 2 : 1;
+    int end = Generate(team, 0);
+    Undo u;
+    
+    Tasks = malloc(sizeof(Perft_Task) * 256 * 256);
+    Task_Count = 0;
+    
+    for(int i = 0; i < end; i++)
+    {
+        int *m = MoveStack[i];
+        
+        atomic_store(&Root_Nodes[i], 0);
+        
+        if(split == 1)
+        {
+            Perft_Task *t = &Tasks[Task_Count++];
+            
+            t->root = i;
+            t->n = 1;
+            memcpy(t->m[0], m, sizeof(t->m[0]));
+            continue;
+        }
+        
+        Make_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+        int replies = Generate(1 - team, end);
+        
+        for(int j = end; j < replies; j++)
+        {
+            Perft_Task *t = &Tasks[Task_Count++];
+            
+            t->root = i;
+            t->n = 2;
+            memcpy(t->m[0], m, sizeof(t->m[0]));
+            memcpy(t->m[1], MoveStack[j], sizeof(t->m[1]));
+        }
+        Unmake_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+    }
+    
+    Task_FEN = fen;
+    Task_Depth = depth;
+    atomic_store(&Next_Task, 0);
+    
+    pthread_t workers[256];
+    
+    for(int t = 0; t < threads; t++)
+    {
+        pthread_create(&workers[t], NULL, Perft_Worker, NULL);
+    }
+    for(int t = 0; t < threads; t++)
+    {
+        pthread_join(workers[t], NULL);
+    }
+    
+    free(Tasks);
+    
+    long long nodes = 0;
+    
+    for(int i = 0; i < end; i++){nodes += Root_Nodes[i];}
+    
+    *roots = end;
+    
+    return nodes;
+}
+
+int Run_Perft(const char *fen, int depth, int divide, int threads, int scaling)
+{
+    int team = Load_FEN(fen);
+    
+    if(team == -1)
+    {
+        printf("Invalid position: %s\n", fen);
+        return 1;
+    }
+    if(threads < 1){threads = 1;}
+    if(threads > 256){threads = 256;}
+    
+    if(scaling)   // Same tree with 1, 2, 4 ... threads up to the number asked for
+    {
+        double base = 0;
+        
+        for(int t = 1; ; t = min(t*2, threads))
+        {
+            if(Perft_Table != NULL){memset(Perft_Table, 0, (Perft_Mask + 1) * sizeof(Perft_Entry));}
+            
+            int roots;
+            double start = Now();
+            long long nodes = Parallel_Perft(fen, depth, t, &roots);
+            double time = Now() - start;
+            
+            if(t == 1){base = time;}
+            
+            printf("Threads: %3d  Nodes: %lld  Time: %.3f s  NPS: %.0f  Speedup: %.2f  Efficiency: %.0f%%\n",
+                   t, nodes, time, time > 0 ? nodes / time : 0, time > 0 ? base / time : 0, time > 0 ? 100 * base / time / t : 0);
+            
+            if(t == threads){break;}
+        }
+        return 0;
+    }
+    
+    double start = Now();
+    long long nodes = 0;
+    char name[8];
+    
+    if(threads > 1)
+    {
+        int roots;
+        
+        nodes = Parallel_Perft(fen, depth, threads, &roots);
+        
+        if(divide)
+        {
+            for(int i = 0; i < roots; i++)
+            {
+                Move_Name(MoveStack[i], team, name);
+                printf("%s: %lld\n", name, (long long)Root_Nodes[i]);
+            }
+        }
+    }
+    else if(divide)
+    {
+        int end = Generate(team, 0);
+        Undo u;
+        
+        for(int i = 0; i < end; i++)
+        {
+            int *m = MoveStack[i];
+            
+            Make_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+            long long n = depth > 1 ? Perft(depth - 1, 1 - team, end) : 1;
+            Unmake_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+            
+            Move_Name(m, team, name);
+            printf("%s: %lld\n", name, n);
+            
+            nodes += n;
+        }
+    }
+    else
+    {
+        nodes = Perft(depth, team, 0);
+    }
+    
+    double time = Now() - start;
+    
+    printf("Nodes: %lld  Time: %.3f s  NPS: %.0f\n", nodes, time, time > 0 ? nodes / time : 0);
+    
+    return 0;
+}
+
+// Perft regression suite: standard positions with their known node counts. Run after every change
+// to Check, Legal or LegalMoves; it fails (exit status 1) on any wrong count and times every position.
+
+typedef struct
+{
+    const char *name;
+    const char *fen;
+    int depth;
+    long long nodes;
+} Perft_Position;
+
+Perft_Position Perft_Suite[] =
+{
+    {"Start position",             "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",               5, 4865609},
+    {"Kiwipete",                   "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",   4, 4085603},
+    {"Position 3",                 "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",                              6, 11030083},
+    {"Position 4",                 "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",       4, 422333},
+    {"Position 4 mirrored",        "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",       4, 422333},
+    {"Position 5",                 "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",              4, 2103487},
+    {"Position 6",                 "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594},
+    {"Illegal en passant 1",       "3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1",                                      6, 1134888},
+    {"Illegal en passant 2",       "8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1",                                     6, 1015133},
+    {"En passant gives check",     "8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1",                                    6, 1440467},
+    {"King castle gives check",    "5k2/8/8/8/8/8/8/4K2R w K - 0 1",                                         6, 661072},
+    {"Queen castle gives check",   "3k4/8/8/8/8/8/8/R3K3 w Q - 0 1",                                         6, 803711},
+    {"Castling rights",            "r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1",                              4, 1274206},
+    {"Castling prevented",         "r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1",                               4, 1720476},
+    {"Promote out of check",       "2K2r2/4P3/8/8/8/8/8/3k4 w - - 0 1",                                      6, 3821001},
+    {"Discovered check",           "8/8/1P2K3/8/2n5/1q6/8/5k2 b - - 0 1",                                    5, 1004658},
+    {"Promote to give check",      "4k3/1P6/8/8/8/8/K7/8 w - - 0 1",                                         6, 217342},
+    {"Underpromote to give check", "8/P1k5/K7/8/8/8/8/8 w - - 0 1",                                          6, 92683},
+    {"Self stalemate",             "K1k5/8/P7/8/8/8/8/8 w - - 0 1",                                          6, 2217},
+    {"Stalemate and checkmate 1",  "8/k1P5/8/1K6/8/8/8/8 w - - 0 1",                                         7, 567584},
+    {"Stalemate and checkmate 2",  "8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1",                                      4, 23527},
+};
+
+int Run_Regress(int threads)
+{
+    int failures = 0;
+    long long total_nodes = 0;
+    double total_time = 0;
+    
+    for(int i = 0; i < (int)(sizeof(Perft_Suite) / sizeof(Perft_Suite[0])); i++)
+    {
+        Perft_Position *pp = &Perft_Suite[i];
+        
+        if(Perft_Table != NULL){memset(Perft_Table, 0, (Perft_Mask + 1) * sizeof(Perft_Entry));}
+        
+        int roots;
+        double start = Now();
+        long long nodes = threads > 1 ? Parallel_Perft(pp->fen, pp->depth, threads, &roots) : Perft(pp->depth, Load_FEN(pp->fen), 0);
+        double time = Now() - start;
+        
+        printf("%-4s %-27s depth %d  nodes %11lld", nodes == pp->nodes ? "ok" : "FAIL", pp->name, pp->depth, nodes);
+        
+        if(nodes != pp->nodes)
+        {
+            printf(" (expected %lld)", pp->nodes);
+            failures += 1;
+        }
+        printf("  %.3f s  %.0f nps\n", time, time > 0 ? nodes / time : 0);
+        
+        total_nodes += nodes;
+        total_time += time;
+    }
+    
+    printf("%d failures  %lld nodes  %.3f s  %.0f nps\n", failures, total_nodes, total_time, total_time > 0 ? total_nodes / total_time : 0);
+    
+    return failures > 0;
+}
+
+// Differential fuzzing: random games where, at every ply, Bitboard_Moves has to find exactly the moves
+// of Generate_Moves (LegalMoves + Legal). Games start from the perft suite positions, for castling,
+// En Passant and promotion cases. The first difference stops every thread and prints the position.
+
+atomic_int Fuzz_Stop;
+_Atomic long long Fuzz_Games;
+_Atomic long long Fuzz_Plies;
+long long Fuzz_Target;   // Games to play, 0 = until a difference is found
+int Fuzz_Rounds;
+pthread_mutex_t Fuzz_Lock = PTHREAD_MUTEX_INITIALIZER;
+
+int Compare_Keys(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+void Print_Key(int key, int team)
+{
+    int m[6];
+    char name[8];
+    
+    Unpack_Move(key, m);
+    Move_Name(m, team, name);
+    printf(" %s (type %d, piece %d)", name, m[0], m[1]);
+}
+
+void *Fuzz_Worker(void *arg)
+{
+    int old_keys[256];
+    int new_keys[256];
+    Undo u;
+    long long plies = 0;
+    
+    Seed ^= (unsigned long long)time(NULL) + 0x9E3779B97F4A7C15ULL * ((unsigned long long)(size_t)arg + 1);
+    
+    while(!atomic_load(&Fuzz_Stop))
+    {
+        long long g = atomic_fetch_add(&Fuzz_Games, 1);
+        
+        if(Fuzz_Target > 0 && g >= Fuzz_Target){break;}
+        
+        int team = Load_FEN(Perft_Suite[Random() % (sizeof(Perft_Suite) / sizeof(Perft_Suite[0]))].fen);
+        
+        for(int ply = 0; ply < 2*Fuzz_Rounds; ply++)
+        {
+            int n_old = Generate_Moves(team, 0);
+            int n_new = Bitboard_Moves(team, n_old) - n_old;
+            
+            for(int i = 0; i < n_old; i++){old_keys[i] = Move_Key(MoveStack[i]);}
+            for(int i = 0; i < n_new; i++){new_keys[i] = Move_Key(MoveStack[n_old + i]);}
+            
+            qsort(old_keys, n_old, sizeof(int), Compare_Keys);
+            qsort(new_keys, n_new, sizeof(int), Compare_Keys);
+            
+            if(n_old != n_new || memcmp(old_keys, new_keys, n_old * sizeof(int)) != 0)
+            {
+                pthread_mutex_lock(&Fuzz_Lock);
+                
+                if(!atomic_exchange(&Fuzz_Stop, 1))
+                {
+                    char fen[128];
+                    int i = 0;
+                    int j = 0;
+                    
+                    Write_FEN(team, fen);
+                    printf("Difference found: %s\n", fen);
+                    printf("Missing from Bitboard_Moves:");
+                    
+                    while(i < n_old || j < n_new)   // Walk both sorted lists
+                    {
+                        if(j == n_new || (i < n_old && old_keys[i] < new_keys[j])){Print_Key(old_keys[i++], team);}
+                        else if(i == n_old || new_keys[j] < old_keys[i]){j++;}
+                        else{i++; j++;}
+                    }
+                    printf("\nNot in Generate_Moves:");
+                    
+                    i = 0;
+                    j = 0;
+                    
+                    while(i < n_old || j < n_new)
+                    {
+                        if(i == n_old || (j < n_new && new_keys[j] < old_keys[i])){Print_Key(new_keys[j++], team);}
+                        else if(j == n_new || old_keys[i] < new_keys[j]){i++;}
+                        else{i++; j++;}
+                    }
+                    printf("\n");
+                }
+                
+                pthread_mutex_unlock(&Fuzz_Lock);
+                break;
+            }
+            
+            if(n_old == 0){break;}
+            
+            int *m = MoveStack[Random() % n_old];
+            
+            Make_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+            
+            team = 1 - team;
+            plies += 1;
+        }
+    }
+    
+    atomic_fetch_add(&Fuzz_Plies, plies);
+    
+    return NULL;
+}
+
+int Fuzz(long long games, int threads, int rounds)
+{
+    pthread_t workers[256];
+    
+    if(threads < 1){threads = 1;}
+    if(threads > 256){threads = 256;}
+    
+    Fuzz_Target = games;
+    Fuzz_Rounds = rounds;
+    
+    double start = Now();
+    
+    for(int t = 0; t < threads; t++)
+    {
+        pthread_create(&workers[t], NULL, Fuzz_Worker, (void *)(size_t)t);
+    }
+    for(int t = 0; t < threads; t++)
+    {
+        pthread_join(workers[t], NULL);
+    }
+    
+    double time = Now() - start;
+    long long played = Fuzz_Games;   // Threads overshoot the target by one claim each
+    
+    if(games > 0 && games < played){played = games;}
+    
+    printf("%s: %lld games, %lld plies in %.1f s (%.0f plies/s)\n", Fuzz_Stop ? "FAILED" : "No difference",
+           played, (long long)Fuzz_Plies, time, time > 0 ? Fuzz_Plies / time : 0);
+    
+    return Fuzz_Stop != 0;
+}
+
+// Search: negamax alpha-beta with iterative deepening, on the bitboard move generator. Scores are in
+// centipawns from the point of view of the team to move; MATE - n means mate in n plies.
+
+#define MATE 32000
+#define MAX_PLY 60
+
+_Thread_local long long Search_Nodes;
+_Thread_local unsigned long long Hash_Stack[MAX_PLY + 1];   // Positions on the path from the root, for repetitions
+unsigned long long Game_Hashes[1024];                       // Positions of the game before the root (UCI), oldest first
+int Game_Length = 0;
+_Thread_local int PV[MAX_PLY + 1][MAX_PLY + 1];             // Principal variation of each ply, as Move_Keys
+_Thread_local int PV_Length[MAX_PLY + 1];
+
+atomic_int Stop;           // Raised when the search has to end
+long long Node_Limit = 0;  // 0 = no limit
+_Atomic long long Total_Nodes;   // Of every search thread, added 1024 at a time
+
+// Time management, in milliseconds. A clock (time left and increment of each team, moves to the next
+// time control) or a fixed time per move gives two deadlines: the soft one, after which no new
+// iteration is started (pushed back while the best move keeps changing), and the hard one, at which
+// every thread stops. Each thread reads the clock every 1024 nodes, the rest only read Stop. The
+// limits are atomic: ponderhit sets them in the UCI thread while the search reads them.
+
+long long Time_Left[2] = {0, 0};   // 0 = no clock
+long long Time_Inc[2] = {0, 0};
+int Moves_To_Go = 0;               // 0 = the rest of the game
+long long Move_Time = 0;           // Fixed time per move, 0 = none
+long long Move_Overhead = 10;      // Kept back for the time it takes the move to reach the clock
+_Atomic double Soft_Time = 0;      // Seconds from Clock_Start, 0 = no limit
+_Atomic double Hard_Deadline = 0;  // Now() at which the search stops, 0 = no limit
+_Atomic double Clock_Start;        // When the search started, or the ponder search turned into the real one
+atomic_int Pondering;              // No time limit, and no bestmove before ponderhit or stop (also go infinite)
+
+void Count_Nodes(void)   // Called by each thread every 1024 nodes
+{
+    long long n = atomic_fetch_add_explicit(&Total_Nodes, 1024, memory_order_relaxed) + 1024;
+    
+    if(Node_Limit > 0 && n >= Node_Limit){atomic_store(&Stop, 1);}
+    if(Hard_Deadline > 0 && Now() >= Hard_Deadline){atomic_store(&Stop, 1);}
+}
+
+_Thread_local int First_Iteration;   // The main thread at depth 1, which ends whatever the limits so that there is a move to play
+
+static inline int Stopped(void)
+{
+    return atomic_load_explicit(&Stop, memory_order_relaxed) && !First_Iteration;
+}
+
+void Set_Deadlines(int team, double start)
+{
+    double soft = 0;
+    double hard = 0;
+    
+    if(Move_Time > 0)
+    {
+        soft = hard = Move_Time - Move_Overhead;
+    }
+    else if(Time_Left[team] > 0)
+    {
+        long long left = Time_Left[team] - Move_Overhead;
+        int moves = Moves_To_Go > 0 ? Moves_To_Go : 30;   // Moves still to play before the time runs out, a guess without a time control
+        
+        soft = (double)left / moves + Time_Inc[team] * 3 / 4;
+        hard = soft * 4;
+        
+        if(hard > left / 2 + Time_Inc[team] && Moves_To_Go != 1){hard = left / 2 + Time_Inc[team];}   // Never bet most of the clock on one move
+        if(hard > left){hard = left;}
+        if(soft > hard){soft = hard;}
+    }
+    if(Move_Time > 0 || Time_Left[team] > 0)
+    {
+        if(hard < 1){soft = hard = 1;}
+        
+        Soft_Time = soft / 1000;
+        Hard_Deadline = start + hard / 1000;
+    }
+    else
+    {
+        Soft_Time = 0;
+        Hard_Deadline = 0;
+    }
+}
+
+// Transposition table: buckets of four 16 byte entries, one 64 byte cache line each, shared by every
+// search thread without locks. An entry stores Hash ^ data next to data, so an entry torn by two
+// threads writing at once doesn't verify and is just a miss. In a full bucket the entry replaced is
+// the one with the lowest depth, counting older searches (age) as less deep.
+
+#define BOUND_UPPER 1
+#define BOUND_LOWER 2
+#define BOUND_EXACT 3
+
+typedef struct
+{
+    unsigned long long key;    // Hash ^ data
+    unsigned long long data;   // move (22 bits) | score + 32768 (16) | depth (8) | bound (2) | age (6)
+} TT_Entry;
+
+typedef struct
+{
+    TT_Entry entry[4];
+} TT_Bucket;
+
+TT_Bucket *TT = NULL;
+unsigned long long TT_Buckets = 0;
+int TT_Age = 0;   // Raised by every new search
+
+_Thread_local long long TT_Probes;
+_Thread_local long long TT_Hits;
+
+int TT_Init(long long mb)   // 0 if mb is below 1 (the table is left as it was) or can't be allocated
+{
+    if(mb < 1){return 0;}
+    
+    free(TT);
+    
+    TT_Buckets = (unsigned long long)mb * 1024 * 1024 / sizeof(TT_Bucket);
+    TT = aligned_alloc(64, TT_Buckets * sizeof(TT_Bucket));
+    
+    if(TT == NULL){TT_Buckets = 0; return 0;}
+    
+    memset(TT, 0, TT_Buckets * sizeof(TT_Bucket));
+    
+    return 1;
+}
+
+void TT_Clear(void)
+{
+    if(TT != NULL){memset(TT, 0, TT_Buckets * sizeof(TT_Bucket));}
+}
+
+TT_Bucket *TT_Bucket_Of(unsigned long long hash)   // Any table size, not only powers of two
+{
+    return &TT[(unsigned long long)(((unsigned __int128)hash * TT_Buckets) >> 64)];
+}
+
+int TT_Probe(int *move, int *score, int *depth, int *bound, int ply)   // 1 on a hit
+{
+    if(TT == NULL){return 0;}
+    
+    TT_Bucket *b = TT_Bucket_Of(Hash);
+    
+    TT_Probes += 1;
+    
+    for(int i = 0; i < 4; i++)
+    {
+        unsigned long long data = b->entry[i].data;
+        
+        if((b->entry[i].key ^ data) == Hash)
+        {
+            *move = data & 0x3FFFFF;
+            *score = (int)(data >> 22 & 0xFFFF) - 32768;
+            *depth = data >> 38 & 255;
+            *bound = data >> 46 & 3;
+            
+            if(*score > MATE - MAX_PLY){*score -= ply;}    // Mates are stored as distance from this node
+            if(*score < -MATE + MAX_PLY){*score += ply;}
+            
+            TT_Hits += 1;
+            
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void TT_Store(int move, int score, int depth, int bound, int ply)
+{
+    if(TT == NULL){return;}
+    
+    TT_Bucket *b = TT_Bucket_Of(Hash);
+    TT_Entry *replace = &b->entry[0];
+    int lowest = 1 << 30;
+    
+    for(int i = 0; i < 4; i++)
+    {
+        TT_Entry *e = &b->entry[i];
+        unsigned long long data = e->data;
+        
+        if((e->key ^ data) == Hash)   // Same position: keep its move if there is no new one
+        {
+            if(move == 0){move = data & 0x3FFFFF;}
+            replace = e;
+            break;
+        }
+        
+        int value = (int)(data >> 38 & 255) - 8 * ((TT_Age - (int)(data >> 48 & 63)) & 63);
+        
+        if(data == 0){value = -(1 << 20);}   // Empty
+        
+        if(value < lowest)
+        {
+            lowest = value;
+            replace = e;
+        }
+    }
+    
+    if(score > MATE - MAX_PLY){score += ply;}
+    if(score < -MATE + MAX_PLY){score -= ply;}
+    
+    unsigned long long data = (unsigned long long)move | (unsigned long long)(score + 32768) << 22 | (unsigned long long)depth << 38
+                            | (unsigned long long)bound << 46 | (unsigned long long)(TT_Age & 63) << 48;
+    
+    replace->key = Hash ^ data;
+    replace->data = data;
+}
+
+int TT_Full(void)   // Permille of the entries written by the current search, from a sample of the table
+{
+    int full = 0;
+    unsigned long long n = TT_Buckets < 1000 ? TT_Buckets : 1000;
+    
+    for(unsigned long long i = 0; i < n; i++)
+    {
+        for(int j = 0; j < 4; j++)
+        {
+            unsigned long long data = TT[i].entry[j].data;
+            
+            if(data != 0 && (int)(data >> 48 & 63) == (TT_Age & 63)){full += 1;}
+        }
+    }
+    return n > 0 ? full * 1000 / (int)(4 * n) : 0;
+}
+
+// Pawn structure: doubled, isolated, backward and passed pawns. It only changes when a pawn moves or
+// is taken, so its score is kept in a table of its own, indexed by Pawn_Hash (the hash of the pawns
+// alone, kept by Toggle), with the passed pawns found. Shared by the threads without locks like the
+// transposition table: an entry stores the key xored with its data, so a torn entry is a miss.
+
+typedef struct
+{
+    unsigned long long check;       // Pawn key ^ passed[0] ^ passed[1] ^ score
+    unsigned long long passed[2];   // Passed pawns of each team
+    unsigned long long score;       // Middlegame + 32768 | endgame + 32768 << 16, White's point of view
+} Pawn_Entry;
+
+Pawn_Entry *Pawn_Table = NULL;
+unsigned long long Pawn_Mask = 0;
+
+_Thread_local long long Pawn_Probes;
+_Thread_local long long Pawn_Hits;
+
+unsigned long long File_Mask[8];
+unsigned long long Adjacent_Files[8];
+unsigned long long Passed_Mask[2][64];    // Squares ahead on the file and the ones beside it: no enemy pawn there = passed
+unsigned long long Support_Mask[2][64];   // Squares beside and behind on the files next to it, where a pawn could defend it
+
+const int Passed_MG[8] = {0, 5, 5, 10, 20, 35, 60, 0};   // By rank, from the pawn's own side
+const int Passed_EG[8] = {0, 10, 15, 25, 45, 75, 120, 0};
+
+void Init_Pawns(void)
+{
+    for(int f = 0; f < 8; f++)
+    {
+        File_Mask[f] = 0x0101010101010101ULL << f;
+    }
+    for(int f = 0; f < 8; f++)
+    {
+        Adjacent_Files[f] = (f > 0 ? File_Mask[f - 1] : 0) | (f < 7 ? File_Mask[f + 1] : 0);
+    }
+    for(int sq = 0; sq < 64; sq++)
+    {
+        int r = sq / 8;
+        int f = sq % 8;
+        unsigned long long files = File_Mask[f] | Adjacent_Files[f];
+        unsigned long long above = r < 7 ? ~0ULL << (8 * (r + 1)) : 0;   // Ranks above r
+        unsigned long long below = (1ULL << (8 * r)) - 1;                 // Ranks below r
+        unsigned long long rank = 0xFFULL << (8 * r);
+        
+        Passed_Mask[0][sq] = files & above;
+        Passed_Mask[1][sq] = files & below;
+        Support_Mask[0][sq] = Adjacent_Files[f] & (below | rank);
+        Support_Mask[1][sq] = Adjacent_Files[f] & (above | rank);
+    }
+}
+
+int Pawn_Table_Init(long long mb)   // Largest power of two number of entries that fits in mb megabytes. 0 if mb is below 1 (the table is left as it was)
+{
+    if(mb < 1){return 0;}
+    
+    free(Pawn_Table);
+    
+    unsigned long long entries = 1;
+    
+    while(entries * 2 * sizeof(Pawn_Entry) <= (unsigned long long)mb * 1024 * 1024){entries *= 2;}
+    
+    Pawn_Table = calloc(entries, sizeof(Pawn_Entry));
+    Pawn_Mask = Pawn_Table != NULL ? entries - 1 : 0;
+    
+    return Pawn_Table != NULL;
+}
+
+void Pawn_Structure(int *mg, int *eg, unsigned long long *passed)   // From scratch, White minus Black
+{
+    *mg = 0;
+    *eg = 0;
+    
+    for(int t = 0; t < 2; t++)
+    {
+        unsigned long long own = Bitboards[t][1];
+        unsigned long long enemy = Bitboards[1 - t][1];
+        int s = t == 0 ? 1 : -1;
+        
+        passed[t] = 0;
+        
+        for(int f = 0; f < 8; f++)   // Doubled
+        {
+            int n = __builtin_popcountll(own & File_Mask[f]);
+            
+            if(n > 1)
+            {
+                *mg -= s * 10 * (n - 1);
+                *eg -= s * 20 * (n - 1);
+            }
+        }
+        
+        for(unsigned long long b = own; b != 0; b &= b - 1)
+        {
+            int sq = __builtin_ctzll(b);
+            int r = t == 0 ? sq / 8 : 7 - sq / 8;   // Rank from the team's side
+            int stop = t == 0 ? sq + 8 : sq - 8;    // Square in front
+            
+            if((own & Adjacent_Files[sq % 8]) == 0)   // Isolated
+            {
+                *mg -= s * 10;
+                *eg -= s * 15;
+            }
+            else if((own & Support_Mask[t][sq]) == 0 && (Pawn_Attacks[t][stop] & enemy) != 0)   // Backward: can't be defended, can't advance
+            {
+                *mg -= s * 8;
+                *eg -= s * 10;
+            }
+            
+            if((enemy & Passed_Mask[t][sq]) == 0 && (own & Passed_Mask[t][sq] & File_Mask[sq % 8]) == 0)   // Passed (the front one of doubled pawns)
+            {
+                passed[t] |= 1ULL << sq;
+                *mg += s * Passed_MG[r];
+                *eg += s * Passed_EG[r];
+            }
+        }
+    }
+}
+
+void Probe_Pawns(int *mg, int *eg, unsigned long long *passed)
+{
+    if(Pawn_Table == NULL)
+    {
+        Pawn_Structure(mg, eg, passed);
+        return;
+    }
+    
+    Pawn_Entry *e = &Pawn_Table[Pawn_Hash & Pawn_Mask];
+    unsigned long long p0 = e->passed[0];
+    unsigned long long p1 = e->passed[1];
+    unsigned long long score = e->score;
+    
+    Pawn_Probes += 1;
+    
+    if((e->check ^ p0 ^ p1 ^ score) == Pawn_Hash && score != 0)
+    {
+        Pawn_Hits += 1;
+        
+        passed[0] = p0;
+        passed[1] = p1;
+        *mg = (int)(score & 0xFFFF) - 32768;
+        *eg = (int)(score >> 16 & 0xFFFF) - 32768;
+        return;
+    }
+    
+    Pawn_Structure(mg, eg, passed);
+    
+    score = (unsigned long long)(*mg + 32768) | (unsigned long long)(*eg + 32768) << 16;
+    
+    e->passed[0] = passed[0];
+    e->passed[1] = passed[1];
+    e->score = score;
+    e->check = Pawn_Hash ^ passed[0] ^ passed[1] ^ score;
+}
+
+// Evaluation cache: the search evaluates the same positions again in each iteration and in each thread,
+// so evaluations are kept in a small table of their own, indexed by Hash, that fits in the L2 or L3
+// cache instead of taking room in the transposition table. An entry is a single word, the top 48 bits
+// of the key with the score (+ 32768) in the low 16, so the threads share it without locks.
+
+unsigned long long *Eval_Cache = NULL;
+unsigned long long Eval_Mask = 0;
+
+_Thread_local long long Eval_Probes;
+_Thread_local long long Eval_Hits;
+
+int Eval_Cache_Init(long long kb)   // Largest power of two number of entries that fits in kb kilobytes. 0 if kb is below 1 (the cache is left as it was)
+{
+    if(kb < 1){return 0;}
+    
+    free(Eval_Cache);
+    
+    unsigned long long entries = 1;
+    
+    while(entries * 2 * sizeof(unsigned long long) <= (unsigned long long)kb * 1024){entries *= 2;}
+    
+    Eval_Cache = calloc(entries, sizeof(unsigned long long));
+    Eval_Mask = Eval_Cache != NULL ? entries - 1 : 0;
+    
+    return Eval_Cache != NULL;
+}
+
+void Eval_Cache_Clear(void)   // The evaluation changed (a network was loaded)
+{
+    if(Eval_Cache != NULL){memset(Eval_Cache, 0, (Eval_Mask + 1) * sizeof(unsigned long long));}
+}
+
+// The network: HalfKP-like inputs (for each king, the 640 pairs of square and non-king piece of
+// either team, from that king's side of the board: 40960 inputs) into 256 sums per king, then two
+// layers of 32 and the output. The sums are 16 bit integers; clipped to 0..127 they are the 8 bit
+// inputs of the next layer (the team to move's half first), whose 8 bit weights are scaled by 64 so
+// that a layer's 32 bit results shifted by 6 are on the same 0..127 scale. The output divided by 16
+// is in centipawns. The kernels use AVX-512, AVX2 or SSE when the compiler targets them (-march=native),
+// a plain loop for what remains; NO_SIMD keeps only the loops.
+//
+// File: "CHESSYNN", then 32 bit integers version (1), inputs, hidden, l1, l2, then in this order the
+// feature biases (16 bit, hidden) and weights (16 bit, inputs x hidden), l1 biases (32 bit) and weights
+// (8 bit, l1 x 2*hidden), l2 biases and weights (l2 x l1), the output bias (32 bit) and weights (8 bit, l2).
+
+#define NNUE_INPUTS (64 * 640)
+#define NNUE_L1 32
+#define NNUE_L2 32
+
+short *NNUE_Bias;                                   // [NNUE_HIDDEN]
+short *NNUE_Weight;                                 // [NNUE_INPUTS][NNUE_HIDDEN]
+_Alignas(64) int L1_Bias[NNUE_L1];
+_Alignas(64) signed char L1_Weight[NNUE_L1][2 * NNUE_HIDDEN];
+_Alignas(64) int L2_Bias[NNUE_L2];
+_Alignas(64) signed char L2_Weight[NNUE_L2][NNUE_L1];
+int Out_Bias;
+_Alignas(64) signed char Out_Weight[NNUE_L2];
+
+int NNUE_Load(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    
+    if(f == NULL)
+    {
+        printf("Can't open %s\n", path);
+        return 0;
+    }
+    
+    char magic[8];
+    int header[5];
+    int ok = fread(magic, 1, 8, f) == 8 && memcmp(magic, "CHESSYNN", 8) == 0 && fread(header, sizeof(int), 5, f) == 5
+          && header[0] == 1 && header[1] == NNUE_INPUTS && header[2] == NNUE_HIDDEN && header[3] == NNUE_L1 && header[4] == NNUE_L2;
+    
+    if(ok && NNUE_Weight == NULL)
+    {
+        NNUE_Bias = aligned_alloc(64, NNUE_HIDDEN * sizeof(short));
+        NNUE_Weight = aligned_alloc(64, (size_t)NNUE_INPUTS * NNUE_HIDDEN * sizeof(short));
+        ok = NNUE_Bias != NULL && NNUE_Weight != NULL;
+    }
+    
+    ok = ok && fread(NNUE_Bias, sizeof(short), NNUE_HIDDEN, f) == NNUE_HIDDEN
+            && fread(NNUE_Weight, sizeof(short), (size_t)NNUE_INPUTS * NNUE_HIDDEN, f) == (size_t)NNUE_INPUTS * NNUE_HIDDEN
+            && fread(L1_Bias, sizeof(int), NNUE_L1, f) == NNUE_L1
+            && fread(L1_Weight, 1, sizeof(L1_Weight), f) == sizeof(L1_Weight)
+            && fread(L2_Bias, sizeof(int), NNUE_L2, f) == NNUE_L2
+            && fread(L2_Weight, 1, sizeof(L2_Weight), f) == sizeof(L2_Weight)
+            && fread(&Out_Bias, sizeof(int), 1, f) == 1
+            && fread(Out_Weight, 1, sizeof(Out_Weight), f) == sizeof(Out_Weight);
+    
+    fclose(f);
+    
+    if(!ok){printf("%s is not a network this build can use\n", path);}
+    
+    NNUE_Loaded = ok;
+    Eval_Cache_Clear();
+    
+    return ok;
+}
+
+void Acc_Add(short *acc, const short *col)
+{
+    int i = 0;
+    
+#if defined(__AVX512BW__) && !defined(NO_SIMD)
+    for(; i + 32 <= NNUE_HIDDEN; i += 32)
+    {
+        _mm512_store_si512((__m512i *)(acc + i), _mm512_add_epi16(_mm512_load_si512((__m512i *)(acc + i)), _mm512_load_si512((__m512i *)(col + i))));
+    }
+#endif
+#if defined(__AVX2__) && !defined(NO_SIMD)
+    for(; i + 16 <= NNUE_HIDDEN; i += 16)
+    {
+        _mm256_store_si256((__m256i *)(acc + i), _mm256_add_epi16(_mm256_load_si256((__m256i *)(acc + i)), _mm256_load_si256((__m256i *)(col + i))));
+    }
+#endif
+#if defined(__SSE2__) && !defined(NO_SIMD)
+    for(; i + 8 <= NNUE_HIDDEN; i += 8)
+    {
+        _mm_store_si128((__m128i *)(acc + i), _mm_add_epi16(_mm_load_si128((__m128i *)(acc + i)), _mm_load_si128((__m128i *)(col + i))));
+    }
+#endif
+    for(; i < NNUE_HIDDEN; i++){acc[i] += col[i];}
+}
+
+void Acc_Sub(short *acc, const short *col)
+{
+    int i = 0;
+    
+#if defined(__AVX512BW__) && !defined(NO_SIMD)
+    for(; i + 32 <= NNUE_HIDDEN; i += 32)
+    {
+        _mm512_store_si512((__m512i *)(acc + i), _mm512_sub_epi16(_mm512_load_si512((__m512i *)(acc + i)), _mm512_load_si512((__m512i *)(col + i))));
+    }
+#endif
+#if defined(__AVX2__) && !defined(NO_SIMD)
+    for(; i + 16 <= NNUE_HIDDEN; i += 16)
+    {
+        _mm256_store_si256((__m256i *)(acc + i), _mm256_sub_epi16(_mm256_load_si256((__m256i *)(acc + i)), _mm256_load_si256((__m256i *)(col + i))));
+    }
+#endif
+#if defined(__SSE2__) && !defined(NO_SIMD)
+    for(; i + 8 <= NNUE_HIDDEN; i += 8)
+    {
+        _mm_store_si128((__m128i *)(acc + i), _mm_sub_epi16(_mm_load_si128((__m128i *)(acc + i)), _mm_load_si128((__m128i *)(col + i))));
+    }
+#endif
+    for(; i < NNUE_HIDDEN; i++){acc[i] -= col[i];}
+}
+
+void Clip_Sums(const short *in, unsigned char *out, int n)   // 16 bit sums to 0..127
+{
+    int i = 0;
+    
+#if defined(__AVX512BW__) && !defined(NO_SIMD)
+    for(; i + 32 <= n; i += 32)
+    {
+        __m512i x = _mm512_min_epi16(_mm512_max_epi16(_mm512_loadu_si512((const __m512i *)(in + i)), _mm512_setzero_si512()), _mm512_set1_epi16(127));
+        
+        _mm256_storeu_si256((__m256i *)(out + i), _mm512_cvtepi16_epi8(x));
+    }
+#endif
+#if defined(__AVX2__) && !defined(NO_SIMD)
+    for(; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_packus_epi16(_mm256_loadu_si256((const __m256i *)(in + i)), _mm256_loadu_si256((const __m256i *)(in + i + 16)));
+        
+        x = _mm256_permute4x64_epi64(_mm256_min_epu8(x, _mm256_set1_epi8(127)), 0xD8);   // packus works on 128 bit halves
+        _mm256_storeu_si256((__m256i *)(out + i), x);
+    }
+#endif
+#if defined(__SSE2__) && !defined(NO_SIMD)
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_packus_epi16(_mm_loadu_si128((const __m128i *)(in + i)), _mm_loadu_si128((const __m128i *)(in + i + 8)));
+        
+        _mm_storeu_si128((__m128i *)(out + i), _mm_min_epu8(x, _mm_set1_epi8(127)));
+    }
+#endif
+    for(; i < n; i++){out[i] = in[i] < 0 ? 0 : in[i] > 127 ? 127 : in[i];}
+}
+
+int Dot(const unsigned char *a, const signed char *w, int n)   // Inputs 0..127 times 8 bit weights
+{
+    int i = 0;
+    int sum = 0;
+    
+#if defined(__AVX512BW__) && !defined(NO_SIMD)
+    __m512i s512 = _mm512_setzero_si512();
+    
+    for(; i + 64 <= n; i += 64)
+    {
+        __m512i p = _mm512_maddubs_epi16(_mm512_loadu_si512((const __m512i *)(a + i)), _mm512_loadu_si512((const __m512i *)(w + i)));
+        
+        s512 = _mm512_add_epi32(s512, _mm512_madd_epi16(p, _mm512_set1_epi16(1)));
+    }
+    sum += _mm512_reduce_add_epi32(s512);
+#endif
+#if defined(__AVX2__) && !defined(NO_SIMD)
+    __m256i s256 = _mm256_setzero_si256();
+    
+    for(; i + 32 <= n; i += 32)
+    {
+        __m256i p = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(w + i)));
+        
+        s256 = _mm256_add_epi32(s256, _mm256_madd_epi16(p, _mm256_set1_epi16(1)));
+    }
+    
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(s256), _mm256_extracti128_si256(s256, 1));
+    
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    sum += _mm_cvtsi128_si32(s);
+#endif
+#if defined(__SSSE3__) && !defined(NO_SIMD)
+    __m128i s128 = _mm_setzero_si128();
+    
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i p = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(w + i)));
+        
+        s128 = _mm_add_epi32(s128, _mm_madd_epi16(p, _mm_set1_epi16(1)));
+    }
+    s128 = _mm_add_epi32(s128, _mm_shuffle_epi32(s128, 0x4E));
+    s128 = _mm_add_epi32(s128, _mm_shuffle_epi32(s128, 0xB1));
+    sum += _mm_cvtsi128_si32(s128);
+#endif
+    for(; i < n; i++){sum += a[i] * w[i];}
+    
+    return sum;
+}
+
+int Feature(int p, int king, int t, int k, int sq)   // Input index of a piece seen from team p's king
+{
+    if(p == 1)   // Black sees the board upside down
+    {
+        king ^= 56;
+        sq ^= 56;
+    }
+    return king * 640 + ((k - 1) * 2 + (t != p)) * 64 + sq;
+}
+
+void NNUE_Refresh(NNUE_Accumulator *a, int p)   // From the bitboards
+{
+    int king = __builtin_ctzll(Bitboards[p][6]);
+    
+    memcpy(a->v[p], NNUE_Bias, sizeof(a->v[p]));
+    
+    for(int t = 0; t < 2; t++)
+    {
+        for(int k = 1; k < 6; k++)
+        {
+            for(unsigned long long b = Bitboards[t][k]; b != 0; b &= b - 1)
+            {
+                Acc_Add(a->v[p], &NNUE_Weight[(size_t)Feature(p, king, t, k, __builtin_ctzll(b)) * NNUE_HIDDEN]);
+            }
+        }
+    }
+    a->computed[p] = 1;
+}
+
+int Needs_Refresh(NNUE_Accumulator *a, int p)   // p's king moved (or the entry lost track of the changes)
+{
+    if(a->changes > 6){return 1;}
+    
+    for(int i = 0; i < a->changes; i++)
+    {
+        if(a->change[i][1] == 6 && a->change[i][0] == p){return 1;}
+    }
+    return 0;
+}
+
+void NNUE_Update(int p)   // Brings the top entry up to date for p's king
+{
+    int j = Acc_Top;
+    
+    while(!Acc_Stack[j].computed[p])   // Down to an entry that is up to date, if no refresh is needed on the way
+    {
+        if(j == 0 || Needs_Refresh(&Acc_Stack[j], p))
+        {
+            NNUE_Refresh(&Acc_Stack[Acc_Top], p);
+            return;
+        }
+        j -= 1;
+    }
+    
+    int king = __builtin_ctzll(Bitboards[p][6]);
+    
+    for(j += 1; j <= Acc_Top; j++)
+    {
+        NNUE_Accumulator *a = &Acc_Stack[j];
+        
+        memcpy(a->v[p], Acc_Stack[j - 1].v[p], sizeof(a->v[p]));
+        
+        for(int i = 0; i < a->changes; i++)
+        {
+            int *c = a->change[i];
+            
+            if(c[1] == 6){continue;}   // The other king: not an input
+            
+            const short *col = &NNUE_Weight[(size_t)Feature(p, king, c[0], c[1], c[2]) * NNUE_HIDDEN];
+            
+            if(c[3]){Acc_Add(a->v[p], col);}
+            else{Acc_Sub(a->v[p], col);}
+        }
+        a->computed[p] = 1;
+    }
+}
+
+int NNUE_Output(const short *us, const short *them);
+
+int NNUE_Evaluate(int team)
+{
+    NNUE_Update(0);
+    NNUE_Update(1);
+    
+    NNUE_Accumulator *a = &Acc_Stack[Acc_Top];
+    
+    return NNUE_Output(a->v[team], a->v[1 - team]);
+}
+
+int NNUE_Output(const short *us, const short *them)   // The layers after the sums, of the team to move first
+{
+    _Alignas(64) unsigned char input[2 * NNUE_HIDDEN];
+    _Alignas(64) unsigned char hidden1[NNUE_L1];
+    _Alignas(64) unsigned char hidden2[NNUE_L2];
+    
+    Clip_Sums(us, input, NNUE_HIDDEN);
+    Clip_Sums(them, input + NNUE_HIDDEN, NNUE_HIDDEN);
+    
+    for(int i = 0; i < NNUE_L1; i++)
+    {
+        int x = (L1_Bias[i] + Dot(input, L1_Weight[i], 2 * NNUE_HIDDEN)) >> 6;
+        
+        hidden1[i] = x < 0 ? 0 : x > 127 ? 127 : x;
+    }
+    for(int i = 0; i < NNUE_L2; i++)
+    {
+        int x = (L2_Bias[i] + Dot(hidden1, L2_Weight[i], NNUE_L1)) >> 6;
+        
+        hidden2[i] = x < 0 ? 0 : x > 127 ? 127 : x;
+    }
+    int score = (Out_Bias + Dot(hidden2, Out_Weight, NNUE_L2)) / 16;
+    
+    if(score > MATE - MAX_PLY - 1){score = MATE - MAX_PLY - 1;}   // Never read as a mate by the search
+    if(score < -(MATE - MAX_PLY - 1)){score = -(MATE - MAX_PLY - 1);}
+    
+    return score;
+}
+
+// Piece activity, from the attack sets the bitboard move generator uses: mobility (squares attacked
+// that aren't taken by the team's own pieces or covered by enemy pawns), threats (pieces attacked by
+// a pawn, pieces attacked and not defended), attacks on the squares around the enemy king and safe
+// checks (a square giving check that the enemy doesn't cover, reached by a piece of the right kind).
+// Everything is a popcount; pins are ignored.
+
+int Mobility_MG[6] = {0, 0, 4, 5, 2, 1};            // Per square, by kind (knight to queen)
+int Mobility_EG[6] = {0, 0, 4, 5, 4, 2};
+int Mobility_Center[6] = {0, 0, 4, 6, 7, 13};       // Typical number of squares: fewer is a penalty
+int King_Attack_Weight[6] = {0, 0, 20, 20, 40, 80};
+int Attackers_Scale[8] = {0, 0, 50, 75, 88, 94, 97, 99};   // % of the attack weight counted, by number of attackers
+int Safe_Check_MG[6] = {0, 0, 80, 60, 90, 70};
+
+unsigned long long Pawn_Attack_Set(int t)   // Squares attacked by the pawns of team t
+{
+    unsigned long long p = Bitboards[t][1];
+    
+    if(t == 0){return (p & ~File_Mask[0]) << 7 | (p & ~File_Mask[7]) << 9;}
+    return (p & ~File_Mask[0]) >> 9 | (p & ~File_Mask[7]) >> 7;
+}
+
+void Activity(int *mg, int *eg)   // White's point of view
+{
+    unsigned long long occupied = Bitboards[0][0] | Bitboards[1][0];
+    unsigned long long by_kind[2][7];   // Squares attacked by the pieces of each kind, [0] all of them
+    unsigned long long twice[2] = {0, 0};
+    int king_sq[2] = {__builtin_ctzll(Bitboards[0][6]), __builtin_ctzll(Bitboards[1][6])};
+    
+    *mg = 0;
+    *eg = 0;
+    
+    for(int t = 0; t < 2; t++)
+    {
+        by_kind[t][1] = Pawn_Attack_Set(t);
+        by_kind[t][6] = King_Attacks[king_sq[t]];
+        by_kind[t][0] = by_kind[t][1];
+        twice[t] = by_kind[t][1] & by_kind[t][6];
+        by_kind[t][0] |= by_kind[t][6];
+    }
+    for(int t = 0; t < 2; t++)
+    {
+        int sign = t == 0 ? 1 : -1;
+        unsigned long long area = ~Bitboards[t][0] & ~by_kind[1-t][1];
+        unsigned long long zone = King_Attacks[king_sq[1-t]] | Bitboards[1-t][6];
+        int attackers = 0;
+        int weight = 0;
+        
+        for(int k = 2; k < 6; k++)
+        {
+            by_kind[t][k] = 0;
+            
+            for(unsigned long long b = Bitboards[t][k]; b != 0; b &= b - 1)
+            {
+                int sq = __builtin_ctzll(b);
+                unsigned long long a = k == 2 ? Knight_Attacks[sq]
+                                     : k == 3 ? Bishop_Attacks(sq, occupied)
+                                     : k == 4 ? Rook_Attacks(sq, occupied)
+                                     : Bishop_Attacks(sq, occupied) | Rook_Attacks(sq, occupied);
+                int mobility = __builtin_popcountll(a & area) - Mobility_Center[k];
+                
+                *mg += sign * Mobility_MG[k] * mobility;
+                *eg += sign * Mobility_EG[k] * mobility;
+                
+                if(a & zone)
+                {
+                    attackers += 1;
+                    weight += King_Attack_Weight[k] * __builtin_popcountll(a & zone);
+                }
+                
+                twice[t] |= by_kind[t][0] & a;
+                by_kind[t][0] |= a;
+                by_kind[t][k] |= a;
+            }
+        }
+        
+        *mg += sign * weight * Attackers_Scale[attackers < 7 ? attackers : 7] / 100;
+    }
+    for(int t = 0; t < 2; t++)
+    {
+        int sign = t == 0 ? 1 : -1;
+        unsigned long long enemy = Bitboards[1-t][0] & ~Bitboards[1-t][1] & ~Bitboards[1-t][6];   // Knights to queens
+        int by_pawn = __builtin_popcountll(enemy & by_kind[t][1]);
+        int hanging = __builtin_popcountll((enemy | Bitboards[1-t][1]) & by_kind[t][0] & ~by_kind[1-t][0]);
+        
+        *mg += sign * (50 * by_pawn + 40 * hanging);
+        *eg += sign * (40 * by_pawn + 20 * hanging);
+        
+        int k_sq = king_sq[1-t];
+        unsigned long long safe = ~Bitboards[t][0] & (~by_kind[1-t][0] | (twice[t] & ~twice[1-t] & ~by_kind[1-t][1]));
+        unsigned long long bishop_checks = Bishop_Attacks(k_sq, occupied) & safe;
+        unsigned long long rook_checks = Rook_Attacks(k_sq, occupied) & safe;
+        
+        if(Knight_Attacks[k_sq] & safe & by_kind[t][2]){*mg += sign * Safe_Check_MG[2];}
+        if(bishop_checks & by_kind[t][3]){*mg += sign * Safe_Check_MG[3];}
+        if(rook_checks & by_kind[t][4]){*mg += sign * Safe_Check_MG[4];}
+        if((bishop_checks | rook_checks) & by_kind[t][5]){*mg += sign * Safe_Check_MG[5];}
+    }
+}
+
+void Evaluation_Terms(int *mg_score, int *eg_score)   // Material, piece-square, pawn structure and activity balance, White's point of view
+{
+    int mg = MG_Score[0] - MG_Score[1];
+    int eg = EG_Score[0] - EG_Score[1];
+    int pawn_mg;
+    int pawn_eg;
+    unsigned long long passed[2];
+    unsigned long long occupied = Bitboards[0][0] | Bitboards[1][0];
+    
+    Probe_Pawns(&pawn_mg, &pawn_eg, passed);
+    
+    mg += pawn_mg;
+    eg += pawn_eg;
+    
+    int activity_mg;
+    int activity_eg;
+    
+    Activity(&activity_mg, &activity_eg);
+    
+    mg += activity_mg;
+    eg += activity_eg;
+    
+    for(int t = 0; t < 2; t++)   // Passed pawns with nothing in their way to promotion
+    {
+        for(unsigned long long b = passed[t]; b != 0; b &= b - 1)
+        {
+            int sq = __builtin_ctzll(b);
+            
+            if((Passed_Mask[t][sq] & File_Mask[sq % 8] & occupied) == 0){eg += t == 0 ? 20 : -20;}
+        }
+    }
+    
+    *mg_score = mg;
+    *eg_score = eg;
+}
+
+int Evaluate_Position(int team)   // Evaluation_Terms, middlegame and endgame blended by the phase
+{
+    if(NNUE_Loaded){return NNUE_Evaluate(team);}
+    
+    int phase = Phase < 24 ? Phase : 24;
+    int mg;
+    int eg;
+    
+    Evaluation_Terms(&mg, &eg);
+    
+    int score = (mg * phase + eg * (24 - phase)) / 24;
+    
+    return team == 0 ? score : -score;
+}
+
+int Evaluate(int team)   // Evaluate_Position through the evaluation cache, kept inside the non-mate range (and 16 bits)
+{
+    if(Eval_Cache == NULL)
+    {
+        int score = Evaluate_Position(team);
+        
+        return score > MATE - MAX_PLY - 1 ? MATE - MAX_PLY - 1 : score < -(MATE - MAX_PLY - 1) ? -(MATE - MAX_PLY - 1) : score;
+    }
+    
+    unsigned long long *e = &Eval_Cache[Hash & Eval_Mask];
+    unsigned long long entry = *e;
+    
+    Eval_Probes += 1;
+    
+    if(entry != 0 && ((entry ^ Hash) >> 16) == 0)   // Hash includes the team to move
+    {
+        Eval_Hits += 1;
+        return (int)(entry & 0xFFFF) - 32768;
+    }
+    
+    int score = Evaluate_Position(team);
+    
+    if(score > MATE - MAX_PLY - 1){score = MATE - MAX_PLY - 1;}
+    if(score < -(MATE - MAX_PLY - 1)){score = -(MATE - MAX_PLY - 1);}
+    
+    *e = (Hash & ~0xFFFFULL) | (unsigned long long)(score + 32768);
+    
+    return score;
+}
+
+// Batched evaluation, for scoring datasets and the leaves of a tree search (MCTS) many positions at a
+// time. The positions are kept as a structure of arrays (one array per bitboard, one per result),
+// filled from the thread's current position by Batch_Add, which also keeps the piece-square sums and
+// the phase it already has. The rest of Evaluation_Terms is worked out for LANES positions at once,
+// one bitboard of each in a lane of a vector register (8 with AVX-512, 4 with AVX2, 2 with SSE), with
+// set operations only: the attacks of all the pieces of a kind in one direction come from a single
+// fill (Kogge-Stone), and since those rays never overlap, their popcounts add up to the ones the
+// per-piece loop of Activity finds. The pawn structure is worked out the same way from file fills.
+// Without SIMD (one lane) the per-piece loops are used instead. The blend by phase and team to move
+// then runs over the arrays, and threads take parts of the batch. -bench times it against
+// Evaluate_Position one position at a time, and counts the scores that differ.
+
+#if defined(__AVX512F__) && !defined(NO_SIMD)
+#define LANES 8
+#elif defined(__AVX2__) && !defined(NO_SIMD)
+#define LANES 4
+#elif defined(__SSE2__) && !defined(NO_SIMD)
+#define LANES 2
+#else
+#define LANES 1
+#endif
+
+typedef unsigned long long Lanes __attribute__((vector_size(8 * LANES)));   // GCC vector extension
+typedef long long Lane_Scores __attribute__((vector_size(8 * LANES)));
+
+typedef struct
+{
+    int count;
+    int capacity;                          // A multiple of LANES
+    unsigned long long *bitboards[2][7];   // [team][kind][position], as Bitboards
+    unsigned long long *pawn_hash;
+    int *team;                             // To move
+    int *psq_mg;                           // MG_Score and EG_Score, White minus Black
+    int *psq_eg;
+    int *phase;
+    int *mg;                               // Evaluation_Terms, White's point of view
+    int *eg;
+    int *score;                            // Results, for the team to move
+} Position_Batch;
+
+int Batch_Init(Position_Batch *b, int capacity)
+{
+    int ok = 1;
+    
+    capacity = (capacity + LANES - 1) / LANES * LANES;
+    
+    memset(b, 0, sizeof(*b));
+    b->capacity = capacity;
+    
+    for(int t = 0; t < 2; t++)
+    {
+        for(int k = 0; k < 7; k++)
+        {
+            b->bitboards[t][k] = aligned_alloc(64, ((size_t)capacity * sizeof(unsigned long long) + 63) & ~(size_t)63);
+            ok = ok && b->bitboards[t][k] != NULL;
+            
+            if(b->bitboards[t][k] != NULL){memset(b->bitboards[t][k], 0, (size_t)capacity * sizeof(unsigned long long));}
+        }
+    }
+    b->pawn_hash = calloc((size_t)capacity, sizeof(unsigned long long));
+    ok = ok && b->pawn_hash != NULL;
+    
+    int **arrays[7] = {&b->team, &b->psq_mg, &b->psq_eg, &b->phase, &b->mg, &b->eg, &b->score};
+    
+    for(int i = 0; i < 7; i++)
+    {
+        *arrays[i] = aligned_alloc(64, ((size_t)capacity * sizeof(int) + 63) & ~(size_t)63);
+        ok = ok && *arrays[i] != NULL;
+        
+        if(*arrays[i] != NULL){memset(*arrays[i], 0, (size_t)capacity * sizeof(int));}
+    }
+    return ok;
+}
+
+void Batch_Free(Position_Batch *b)
+{
+    for(int t = 0; t < 2; t++)
+    {
+        for(int k = 0; k < 7; k++){free(b->bitboards[t][k]);}
+    }
+    free(b->pawn_hash);
+    free(b->team);
+    free(b->psq_mg);
+    free(b->psq_eg);
+    free(b->phase);
+    free(b->mg);
+    free(b->eg);
+    free(b->score);
+    memset(b, 0, sizeof(*b));
+}
+
+int Batch_Add(Position_Batch *b, int team)   // The thread's current position. Returns its index, -1 if the batch is full
+{
+    if(b->count == b->capacity){return -1;}
+    
+    int i = b->count++;
+    
+    for(int t = 0; t < 2; t++)
+    {
+        for(int k = 0; k < 7; k++){b->bitboards[t][k][i] = Bitboards[t][k];}
+    }
+    b->pawn_hash[i] = Pawn_Hash;
+    b->team[i] = team;
+    b->psq_mg[i] = MG_Score[0] - MG_Score[1];
+    b->psq_eg[i] = EG_Score[0] - EG_Score[1];
+    b->phase[i] = Phase;
+    
+    return i;
+}
+
+const int Ray_Step[8] = {8, 1, 9, 7, -8, -1, -9, -7};          // Same directions as Rays
+const int Ray_File[8] = {0, 1, 1, -1, 0, -1, -1, 1};
+const int Knight_Step[8] = {17, 10, -6, -15, -17, -10, 6, 15};
+const int Knight_File[8] = {1, 2, 2, 1, -1, -2, -2, -1};
+
+static inline unsigned long long Step_Mask(int df)   // Squares a step df files sideways can land on without wrapping around
+{
+    return df == 1 ? 0xFEFEFEFEFEFEFEFEULL : df == 2 ? 0xFCFCFCFCFCFCFCFCULL
+         : df == -1 ? 0x7F7F7F7F7F7F7F7FULL : df == -2 ? 0x3F3F3F3F3F3F3F3FULL : ~0ULL;
+}
+
+static inline Lanes Shift(Lanes x, int step)
+{
+    return step > 0 ? x << step : x >> -step;
+}
+
+// Counting runs in two steps: the bits of each byte, then the bytes of each lane. Byte counts of up to 31
+// bitboards can be added before the second step, which saves most of it for sums of several counts
+static inline Lanes Byte_Counts(Lanes x)
+{
+#if defined(__AVX512BITALG__) && LANES == 8
+    return (Lanes)_mm512_popcnt_epi8((__m512i)x);
+#elif defined(__AVX512BW__) && LANES == 8
+    __m512i table = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4));
+    __m512i low = _mm512_set1_epi8(15);
+    
+    return (Lanes)_mm512_add_epi8(_mm512_shuffle_epi8(table, _mm512_and_si512((__m512i)x, low)),
+                                  _mm512_shuffle_epi8(table, _mm512_and_si512(_mm512_srli_epi16((__m512i)x, 4), low)));
+#elif defined(__AVX2__) && LANES == 4
+    __m256i table = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4));
+    __m256i low = _mm256_set1_epi8(15);
+    
+    return (Lanes)_mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256((__m256i)x, low)),
+                                  _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16((__m256i)x, 4), low)));
+#elif defined(__SSSE3__) && LANES == 2
+    __m128i table = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    __m128i low = _mm_set1_epi8(15);
+    
+    return (Lanes)_mm_add_epi8(_mm_shuffle_epi8(table, _mm_and_si128((__m128i)x, low)),
+                               _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16((__m128i)x, 4), low)));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    
+    return (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+#endif
+}
+
+static inline Lane_Scores Sum_Bytes(Lanes x)
+{
+#if defined(__AVX512BW__) && LANES == 8
+    return (Lane_Scores)_mm512_sad_epu8((__m512i)x, _mm512_setzero_si512());
+#elif defined(__AVX2__) && LANES == 4
+    return (Lane_Scores)_mm256_sad_epu8((__m256i)x, _mm256_setzero_si256());
+#elif defined(__SSE2__) && LANES == 2
+    return (Lane_Scores)_mm_sad_epu8((__m128i)x, _mm_setzero_si128());
+#else
+    x = (x & 0x00FF00FF00FF00FFULL) + ((x >> 8) & 0x00FF00FF00FF00FFULL);
+    
+    return (Lane_Scores)((x * 0x0001000100010001ULL) >> 48);
+#endif
+}
+
+static inline Lane_Scores Count(Lanes x)
+{
+#if defined(__AVX512VPOPCNTDQ__) && LANES == 8
+    return (Lane_Scores)_mm512_popcnt_epi64((__m512i)x);
+#else
+    return Sum_Bytes(Byte_Counts(x));
+#endif
+}
+
+static inline Lanes Slide(Lanes from, Lanes empty, int d)   // Attacks in direction d of sliders on from, up to the first piece in the way
+{
+    int s = Ray_Step[d];
+    unsigned long long mask = Step_Mask(Ray_File[d]);
+    Lanes pass = empty & mask;
+    
+    from |= pass & Shift(from, s);
+    pass &= Shift(pass, s);
+    from |= pass & Shift(from, 2 * s);
+    pass &= Shift(pass, 2 * s);
+    from |= pass & Shift(from, 4 * s);
+    
+    return Shift(from, s) & mask;
+}
+
+static inline Lanes Knight_Jump(Lanes from, int j)
+{
+    return Shift(from, Knight_Step[j]) & Step_Mask(Knight_File[j]);
+}
+
+static inline Lanes Fill_Up(Lanes x)   // Squares on and above
+{
+    x |= x << 8;
+    x |= x << 16;
+    
+    return x | x << 32;
+}
+
+static inline Lanes Fill_Down(Lanes x)
+{
+    x |= x >> 8;
+    x |= x >> 16;
+    
+    return x | x >> 32;
+}
+
+static inline Lanes Sideways(Lanes x)   // The files on either side
+{
+    return ((x << 1) & 0xFEFEFEFEFEFEFEFEULL) | ((x >> 1) & 0x7F7F7F7F7F7F7F7FULL);
+}
+
+void Batch_Terms(Position_Batch *b, int first)   // Evaluation_Terms of positions first to first + LANES - 1
+{
+#if LANES == 1   // Nothing to share the fills with, so the per-piece loops with their tables and the pawn table are cheaper
+    int mg = b->psq_mg[first];
+    int eg = b->psq_eg[first];
+    int pawn_mg;
+    int pawn_eg;
+    int activity_mg;
+    int activity_eg;
+    unsigned long long passed[2];
+    
+    for(int t = 0; t < 2; t++)
+    {
+        for(int k = 0; k < 7; k++){Bitboards[t][k] = b->bitboards[t][k][first];}
+    }
+    
+    unsigned long long occupied = Bitboards[0][0] | Bitboards[1][0];
+    
+    Pawn_Hash = b->pawn_hash[first];
+    Probe_Pawns(&pawn_mg, &pawn_eg, passed);
+    Activity(&activity_mg, &activity_eg);
+    
+    mg += pawn_mg + activity_mg;
+    eg += pawn_eg + activity_eg;
+    
+    for(int t = 0; t < 2; t++)
+    {
+        for(unsigned long long p = passed[t]; p != 0; p &= p - 1)
+        {
+            int sq = __builtin_ctzll(p);
+            
+            if((Passed_Mask[t][sq] & File_Mask[sq % 8] & occupied) == 0){eg += t == 0 ? 20 : -20;}
+        }
+    }
+    b->mg[first] = mg;
+    b->eg[first] = eg;
+#else
+    Lanes bb[2][7];
+    Lane_Scores mg;
+    Lane_Scores eg;
+    
+    for(int t = 0; t < 2; t++)
+    {
+        for(int k = 0; k < 7; k++){memcpy(&bb[t][k], &b->bitboards[t][k][first], sizeof(Lanes));}
+    }
+    for(int l = 0; l < LANES; l++)
+    {
+        mg[l] = b->psq_mg[first + l];
+        eg[l] = b->psq_eg[first + l];
+    }
+    
+    Lanes occupied = bb[0][0] | bb[1][0];
+    Lanes empty = ~occupied;
+    Lanes pawn_attacks[2];
+    Lanes all[2];     // Attacked squares
+    Lanes twice[2];   // Attacked by two pieces (both pawns count as one)
+    Lanes by_kind[2][6];
+    Lanes king_zone[2];
+    
+    pawn_attacks[0] = (bb[0][1] & 0xFEFEFEFEFEFEFEFEULL) << 7 | (bb[0][1] & 0x7F7F7F7F7F7F7F7FULL) << 9;
+    pawn_attacks[1] = (bb[1][1] & 0xFEFEFEFEFEFEFEFEULL) >> 9 | (bb[1][1] & 0x7F7F7F7F7F7F7F7FULL) >> 7;
+    
+    for(int t = 0; t < 2; t++)
+    {
+        Lanes king = (Lanes){0};
+        
+        #pragma GCC unroll 8
+        for(int d = 0; d < 8; d++){king |= Shift(bb[t][6], Ray_Step[d]) & Step_Mask(Ray_File[d]);}
+        
+        king_zone[t] = king | bb[t][6];
+        all[t] = pawn_attacks[t] | king;
+        twice[t] = pawn_attacks[t] & king;
+    }
+    
+    for(int t = 0; t < 2; t++)   // Mobility and attacks on the king's squares, as in Activity
+    {
+        int sign = t == 0 ? 1 : -1;
+        Lanes area = ~bb[t][0] & ~pawn_attacks[1-t];
+        Lanes zone = king_zone[1-t];
+        Lane_Scores attackers = (Lane_Scores){0};
+        Lane_Scores weight = (Lane_Scores){0};
+        Lanes zone_rays[8];   // Squares a slider in direction d attacks the zone from, shared by the queen
+        
+        #pragma GCC unroll 8
+        for(int d = 0; d < 8; d++){zone_rays[d] = Slide(zone, empty, d);}
+        
+        #pragma GCC unroll 4
+        for(int k = 2; k < 6; k++)
+        {
+            Lanes pieces = bb[t][k];
+            Lanes reach = (Lanes){0};   // Squares from which a piece of kind k attacks the zone
+            Lanes mobility_bytes = (Lanes){0};
+            Lanes zone_bytes = (Lanes){0};
+            
+            by_kind[t][k] = (Lanes){0};
+            
+            #pragma GCC unroll 8
+            for(int d = 0; d < 8; d++)
+            {
+                Lanes a;
+                
+                if(k == 2)
+                {
+                    a = Knight_Jump(pieces, d);
+                    reach |= Knight_Jump(zone, d);
+                }
+                else if((k == 3 && d % 4 < 2) || (k == 4 && d % 4 >= 2)){continue;}   // Rooks slide N, E, S, W
+                else
+                {
+                    a = Slide(pieces, empty, d);
+                    reach |= zone_rays[d];
+                }
+                
+                mobility_bytes += Byte_Counts(a & area);
+                zone_bytes += Byte_Counts(a & zone);
+                twice[t] |= all[t] & a;
+                all[t] |= a;
+                by_kind[t][k] |= a;
+            }
+            
+            Lane_Scores mobility = Sum_Bytes(mobility_bytes) - Mobility_Center[k] * Count(pieces);
+            Lane_Scores zone_squares = Sum_Bytes(zone_bytes);
+            
+            mg += sign * Mobility_MG[k] * mobility;
+            eg += sign * Mobility_EG[k] * mobility;
+            attackers += Count(pieces & reach);
+            weight += King_Attack_Weight[k] * zone_squares;
+        }
+        for(int l = 0; l < LANES; l++)
+        {
+            mg[l] += sign * weight[l] * Attackers_Scale[attackers[l] < 7 ? attackers[l] : 7] / 100;
+        }
+    }
+    
+    for(int t = 0; t < 2; t++)   // Threats and safe checks
+    {
+        int sign = t == 0 ? 1 : -1;
+        Lanes enemy = bb[1-t][0] & ~bb[1-t][1] & ~bb[1-t][6];
+        Lane_Scores by_pawn = Count(enemy & pawn_attacks[t]);
+        Lane_Scores hanging = Count((enemy | bb[1-t][1]) & all[t] & ~all[1-t]);
+        
+        mg += sign * (50 * by_pawn + 40 * hanging);
+        eg += sign * (40 * by_pawn + 20 * hanging);
+        
+        Lanes king = bb[1-t][6];
+        Lanes safe = ~bb[t][0] & (~all[1-t] | (twice[t] & ~twice[1-t] & ~pawn_attacks[1-t]));
+        Lanes knight_checks = (Lanes){0};
+        Lanes bishop_checks = (Lanes){0};
+        Lanes rook_checks = (Lanes){0};
+        
+        #pragma GCC unroll 8
+        for(int d = 0; d < 8; d++)
+        {
+            knight_checks |= Knight_Jump(king, d);
+            
+            if(d % 4 < 2){rook_checks |= Slide(king, empty, d);}
+            else{bishop_checks |= Slide(king, empty, d);}
+        }
+        knight_checks &= safe;
+        bishop_checks &= safe;
+        rook_checks &= safe;
+        
+        mg += sign * Safe_Check_MG[2] * ((Lane_Scores)((knight_checks & by_kind[t][2]) != 0) & 1);
+        mg += sign * Safe_Check_MG[3] * ((Lane_Scores)((bishop_checks & by_kind[t][3]) != 0) & 1);
+        mg += sign * Safe_Check_MG[4] * ((Lane_Scores)((rook_checks & by_kind[t][4]) != 0) & 1);
+        mg += sign * Safe_Check_MG[5] * ((Lane_Scores)(((bishop_checks | rook_checks) & by_kind[t][5]) != 0) & 1);
+    }
+    
+    for(int t = 0; t < 2; t++)   // Pawn structure, as in Pawn_Structure, and passed pawns with a clear path
+    {
+        int sign = t == 0 ? 1 : -1;
+        Lanes own = bb[t][1];
+        Lanes enemy = bb[1-t][1];
+        Lanes files = Fill_Up(Fill_Down(own));
+        Lane_Scores doubled = Count(own) - Count(files & 0xFF);
+        Lanes isolated = own & ~Sideways(files);
+        Lanes supported = Sideways(t == 0 ? Fill_Up(own) : Fill_Down(own));   // A pawn beside or behind on a file next to it
+        Lanes stop_attacked = t == 0 ? pawn_attacks[1] >> 8 : pawn_attacks[0] << 8;
+        Lanes backward = own & ~isolated & ~supported & stop_attacked;
+        Lanes enemy_front = t == 0 ? Fill_Down(enemy) >> 8 : Fill_Up(enemy) << 8;   // Squares behind enemy pawns, from t's side
+        Lanes own_front = t == 0 ? Fill_Down(own) >> 8 : Fill_Up(own) << 8;
+        Lanes passed = own & ~(enemy_front | Sideways(enemy_front)) & ~own_front;
+        Lanes blocked = t == 0 ? Fill_Down(occupied) >> 8 : Fill_Up(occupied) << 8;
+        
+        mg -= sign * (10 * doubled + 10 * Count(isolated) + 8 * Count(backward));
+        eg -= sign * (20 * doubled + 15 * Count(isolated) + 10 * Count(backward));
+        
+        Lanes ranks = Byte_Counts(passed);   // Passed pawns on each rank
+        
+        for(int r = 1; r < 7; r++)
+        {
+            Lane_Scores n = Sum_Bytes(ranks & (0xFFULL << (8 * (t == 0 ? r : 7 - r))));
+            
+            mg += sign * Passed_MG[r] * n;
+            eg += sign * Passed_EG[r] * n;
+        }
+        eg += sign * 20 * Count(passed & ~blocked);
+    }
+    
+    for(int l = 0; l < LANES; l++)
+    {
+        b->mg[first + l] = (int)mg[l];
+        b->eg[first + l] = (int)eg[l];
+    }
+#endif
+}
+
+void Blend(const int *mg, const int *eg, const int *phase, const int *team, int *score, int n)   // Same as Evaluate's, over arrays
+{
+    int i = 0;
+    int limit = MATE - MAX_PLY - 1;
+    
+    // (mg * p + eg * (24 - p)) / 24 through floats: the products are far below 2^24, and a quotient that
+    // isn't whole is at least 1/24 away from the next integer, so truncating gives the integer division
+    
+#if defined(__AVX512F__) && !defined(NO_SIMD)
+    for(; i + 16 <= n; i += 16)
+    {
+        __m512i p = _mm512_min_epi32(_mm512_loadu_si512((const __m512i *)(phase + i)), _mm512_set1_epi32(24));
+        __m512i x = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_loadu_si512((const __m512i *)(mg + i)), p),
+                                     _mm512_mullo_epi32(_mm512_loadu_si512((const __m512i *)(eg + i)), _mm512_sub_epi32(_mm512_set1_epi32(24), p)));
+        __m512i s = _mm512_cvttps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(x), _mm512_set1_ps(24.0f)));
+        
+        s = _mm512_max_epi32(_mm512_min_epi32(s, _mm512_set1_epi32(limit)), _mm512_set1_epi32(-limit));
+        __m512i m = _mm512_sub_epi32(_mm512_setzero_si512(), _mm512_loadu_si512((const __m512i *)(team + i)));   // 0 or -1
+        
+        _mm512_storeu_si512((__m512i *)(score + i), _mm512_sub_epi32(_mm512_xor_si512(s, m), m));
+    }
+#endif
+#if defined(__AVX2__) && !defined(NO_SIMD)
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256i p = _mm256_min_epi32(_mm256_loadu_si256((const __m256i *)(phase + i)), _mm256_set1_epi32(24));
+        __m256i x = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(mg + i)), p),
+                                     _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(eg + i)), _mm256_sub_epi32(_mm256_set1_epi32(24), p)));
+        __m256i s = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(x), _mm256_set1_ps(24.0f)));
+        
+        s = _mm256_max_epi32(_mm256_min_epi32(s, _mm256_set1_epi32(limit)), _mm256_set1_epi32(-limit));
+        __m256i m = _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_loadu_si256((const __m256i *)(team + i)));
+        
+        _mm256_storeu_si256((__m256i *)(score + i), _mm256_sub_epi32(_mm256_xor_si256(s, m), m));
+    }
+#endif
+#if defined(__SSE4_1__) && !defined(NO_SIMD)
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128i p = _mm_min_epi32(_mm_loadu_si128((const __m128i *)(phase + i)), _mm_set1_epi32(24));
+        __m128i x = _mm_add_epi32(_mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(mg + i)), p),
+                                  _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(eg + i)), _mm_sub_epi32(_mm_set1_epi32(24), p)));
+        __m128i s = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(24.0f)));
+        
+        s = _mm_max_epi32(_mm_min_epi32(s, _mm_set1_epi32(limit)), _mm_set1_epi32(-limit));
+        __m128i m = _mm_sub_epi32(_mm_setzero_si128(), _mm_loadu_si128((const __m128i *)(team + i)));
+        
+        _mm_storeu_si128((__m128i *)(score + i), _mm_sub_epi32(_mm_xor_si128(s, m), m));
+    }
+#endif
+    for(; i < n; i++)
+    {
+        int p = phase[i] < 24 ? phase[i] : 24;
+        int s = (mg[i] * p + eg[i] * (24 - p)) / 24;
+        
+        s = s > limit ? limit : s < -limit ? -limit : s;
+        score[i] = team[i] == 0 ? s : -s;
+    }
+}
+
+typedef struct
+{
+    Position_Batch *batch;
+    int from;
+    int to;
+} Batch_Part;
+
+_Thread_local NNUE_Accumulator Batch_Acc;   // Apart from Acc_Stack, which may belong to a search in progress
+
+void *Batch_Worker(void *arg)
+{
+    Batch_Part *part = arg;
+    Position_Batch *b = part->batch;
+    
+    if(NNUE_Loaded)   // The network's sums, one position at a time
+    {
+        for(int i = part->from; i < part->to; i++)
+        {
+            for(int t = 0; t < 2; t++)
+            {
+                for(int k = 0; k < 7; k++){Bitboards[t][k] = b->bitboards[t][k][i];}
+            }
+            NNUE_Refresh(&Batch_Acc, 0);
+            NNUE_Refresh(&Batch_Acc, 1);
+            b->score[i] = NNUE_Output(Batch_Acc.v[b->team[i]], Batch_Acc.v[1 - b->team[i]]);
+        }
+        return NULL;
+    }
+    
+    for(int i = part->from; i < part->to; i += LANES){Batch_Terms(b, i);}   // Starts are multiples of LANES (the tail lanes are spare)
+    
+    Blend(b->mg + part->from, b->eg + part->from, b->phase + part->from, b->team + part->from, b->score + part->from, part->to - part->from);
+    
+    return NULL;
+}
+
+void Evaluate_Batch(Position_Batch *b, int threads)   // Fills b->score. threads 1 works in the calling thread
+{
+    pthread_t workers[256];
+    Batch_Part parts[256];
+    
+    if(threads < 1){threads = 1;}
+    if(threads > 256){threads = 256;}
+    
+    int blocks = (b->count + LANES - 1) / LANES;
+    
+    for(int t = 0; t < threads; t++)
+    {
+        parts[t].batch = b;
+        parts[t].from = (int)((long long)blocks * t / threads) * LANES;
+        parts[t].to = (int)((long long)blocks * (t + 1) / threads) * LANES;
+        
+        if(parts[t].to > b->count){parts[t].to = b->count;}
+    }
+    
+    if(threads == 1)
+    {
+        unsigned long long saved[2][7];   // The caller's position (the network path loads each one)
+        unsigned long long saved_hash = Pawn_Hash;
+        
+        memcpy(saved, Bitboards, sizeof(saved));
+        Batch_Worker(&parts[0]);
+        memcpy(Bitboards, saved, sizeof(saved));
+        Pawn_Hash = saved_hash;
+        return;
+    }
+    
+    for(int t = 0; t < threads; t++){pthread_create(&workers[t], NULL, Batch_Worker, &parts[t]);}
+    for(int t = 0; t < threads; t++){pthread_join(workers[t], NULL);}
+}
+
+#define BATCH_SIZE 65536
+
+void Single_Evaluations(Position_Batch *b, int *scores)   // The batch through Evaluate_Position, one position at a time (-bench)
+{
+    int limit = MATE - MAX_PLY - 1;
+    
+    for(int i = 0; i < b->count; i++)
+    {
+        for(int t = 0; t < 2; t++)
+        {
+            for(int k = 0; k < 7; k++){Bitboards[t][k] = b->bitboards[t][k][i];}
+        }
+        MG_Score[0] = b->psq_mg[i];
+        MG_Score[1] = 0;
+        EG_Score[0] = b->psq_eg[i];
+        EG_Score[1] = 0;
+        Phase = b->phase[i];
+        Pawn_Hash = b->pawn_hash[i];
+        
+        if(NNUE_Loaded){NNUE_Reset();}
+        
+        int score = Evaluate_Position(b->team[i]);
+        
+        scores[i] = score > limit ? limit : score < -limit ? -limit : score;
+    }
+}
+
+int Evaluate_File(const char *arg, int threads, int quiet, int bench)   // One position (FEN) or a file of them, one per line: the score of each, for the team to move
+{
+    FILE *f = fopen(arg, "r");
+    char (*lines)[256] = malloc(BATCH_SIZE * sizeof(*lines));
+    long long *numbers = malloc(BATCH_SIZE * sizeof(long long));   // Line of each position in the batch
+    int *singles = malloc(BATCH_SIZE * sizeof(int));                // Scores one at a time, for -bench
+    Position_Batch b;
+    
+    if(lines == NULL || numbers == NULL || singles == NULL || !Batch_Init(&b, BATCH_SIZE))
+    {
+        printf("Can't allocate the batch\n");
+        return 1;
+    }
+    
+    long long n = 0;
+    long long positions = 0;
+    long long invalid = 0;
+    long long different = 0;
+    double start = Now();
+    double evaluation = 0;
+    double single = 0;
+    int done = 0;
+    
+    while(!done)
+    {
+        b.count = 0;
+        
+        while(b.count < BATCH_SIZE)
+        {
+            char *line = lines[b.count];
+            
+            if(f == NULL ? n > 0 : fgets(line, sizeof(lines[0]), f) == NULL)
+            {
+                done = 1;
+                break;
+            }
+            if(f == NULL){snprintf(line, sizeof(lines[0]), "%s", arg);}
+            
+            line[strcspn(line, "\r\n")] = 0;
+            n += 1;
+            
+            if(line[0] == 0 || line[0] == '#'){continue;}
+            
+            int team = Load_FEN(line);
+            
+            if(team < 0)
+            {
+                invalid += 1;
+                if(!quiet){printf("%lld: invalid position  %s\n", n, line);}
+                continue;
+            }
+            numbers[Batch_Add(&b, team)] = n;
+        }
+        
+        double time = Now();
+        
+        if(bench)   // First, so that the batch doesn't warm the caches for it
+        {
+            Single_Evaluations(&b, singles);
+            single += Now() - time;
+            time = Now();
+        }
+        Evaluate_Batch(&b, threads);
+        evaluation += Now() - time;
+        positions += b.count;
+        
+        for(int i = 0; bench && i < b.count; i++){different += singles[i] != b.score[i];}
+        
+        if(!quiet)
+        {
+            for(int i = 0; i < b.count; i++)
+            {
+                if(f != NULL){printf("%lld: %d  %s\n", numbers[i], b.score[i], lines[i]);}
+                else{printf("%d\n", b.score[i]);}
+            }
+        }
+    }
+    
+    if(f != NULL)
+    {
+        fclose(f);
+        printf("Total: %lld positions, %lld invalid in %.3f s (evaluation %.3f s, %.0f positions/s)\n", positions, invalid,
+               Now() - start, evaluation, evaluation > 0 ? positions / evaluation : 0);
+    }
+    if(bench && positions > 0)
+    {
+        printf("Batch %.1f ns/position, one at a time %.1f ns/position (%.2fx), %lld different scores\n",
+               evaluation * 1e9 / positions, single * 1e9 / positions, evaluation > 0 ? single / evaluation : 0, different);
+    }
+    
+    Batch_Free(&b);
+    free(lines);
+    free(numbers);
+    free(singles);
+    
+    return 0;
+}
+
+// Move ordering: the hash move first, then captures by MVV-LVA (most valuable victim, least valuable
+// attacker), the two killer moves of the ply, the countermove of the opponent's last move, and the
+// other quiet moves by butterfly history (how often a from-to move has caused a cutoff).
+
+_Thread_local int Move_Score[16384];             // Parallel to MoveStack
+_Thread_local int Killers[MAX_PLY + 1][2];       // Quiet moves that caused a cutoff at the ply, as Move_Keys
+_Thread_local int History[2][64][64];            // [team][from][to]
+_Thread_local int Countermove[2][7][64];         // [team][kind of the opponent's last moving piece][its destination]
+_Thread_local long long Cutoffs;
+_Thread_local long long First_Cutoffs;           // Cutoffs by the first move tried
+
+int Is_Capture(int *m)
+{
+    return m[0] == 3 || Board[m[4]][m[5]] != 0;
+}
+
+int Is_Quiet(int *m)   // Not a capture nor a promotion
+{
+    int mp = m[1] > 0 ? m[1] : -m[1];
+    
+    return !Is_Capture(m) && (m[0] == 1 || m[0] == 2 || mp >= 9 || (m[4] != 7 && m[4] != 0));
+}
+
+int *Counter_Slot(int team)   // Countermove entry for the opponent's last move, NULL if there is none
+{
+    if(Last_Move[0] != 0 && Last_Move[0] < 3){return NULL;}   // No last move, or castling
+    
+    int p = Last_Move[1];
+    
+    return &Countermove[team][p > 0 ? Kind[0][p] : Kind[1][-p]][Last_Move[4]*8 + Last_Move[5]];
+}
+
+void Score_Moves(int LM, int end, int team, int ply, int tt_move)
+{
+    int *counter = Counter_Slot(team);
+    
+    for(int i = LM; i < end; i++)
+    {
+        int *m = MoveStack[i];
+        int key = Move_Key(m);
+        int mp = m[1] > 0 ? Kind[0][m[1]] : Kind[1][-m[1]];
+        
+        if(m[0] == 1 || m[0] == 2){mp = 6;}
+        
+        if(key == tt_move){Move_Score[i] = 1 << 30;}
+        else if(Is_Capture(m))
+        {
+            int bp = Board[m[4]][m[5]];
+            int victim = m[0] == 3 ? 1 : bp > 0 ? Kind[0][bp] : Kind[1][-bp];
+            
+            Move_Score[i] = (1 << 24) + victim * 16 - mp + (m[0] == 0 && mp == 1 && (m[4] == 7 || m[4] == 0) ? 64 : 0);
+            
+            if(victim < mp && mp != 6 && SEE(m) < 0){Move_Score[i] -= (1 << 24) + (1 << 19);}   // Losing captures go after the quiet moves
+        }
+        else if(m[0] == 0 && mp == 1 && (m[4] == 7 || m[4] == 0)){Move_Score[i] = (1 << 24) + 48;}   // Queen promotion
+        else if(key == Killers[ply][0]){Move_Score[i] = (1 << 22) + 1;}
+        else if(key == Killers[ply][1]){Move_Score[i] = 1 << 22;}
+        else if(counter != NULL && key == *counter){Move_Score[i] = 1 << 21;}
+        else if(m[0] >= 4){Move_Score[i] = -(1 << 20);}   // Underpromotions last
+        else if(m[0] == 1 || m[0] == 2){Move_Score[i] = 0;}   // Castling
+        else{Move_Score[i] = History[team][m[2]*8 + m[3]][m[4]*8 + m[5]];}
+    }
+}
+
+void Pick_Move(int i, int end)   // Brings the best scored move still to be tried to MoveStack[i]
+{
+    int best = i;
+    
+    for(int j = i + 1; j < end; j++)
+    {
+        if(Move_Score[j] > Move_Score[best]){best = j;}
+    }
+    if(best != i)
+    {
+        int row[6];
+        int s = Move_Score[i];
+        
+        memcpy(row, MoveStack[i], sizeof(row));
+        memcpy(MoveStack[i], MoveStack[best], sizeof(row));
+        memcpy(MoveStack[best], row, sizeof(row));
+        
+        Move_Score[i] = Move_Score[best];
+        Move_Score[best] = s;
+    }
+}
+
+void Update_History(int *h, int bonus)   // Kept within +-(1 << 20) so it stays under the killers
+{
+    *h += bonus - (int)((long long)*h * (bonus > 0 ? bonus : -bonus) / (1 << 20));   // The product passes 2^31
+}
+
+void Reward_Quiet(int team, int ply, int depth, int LM, int i)   // MoveStack[i] caused a cutoff; the quiet moves before it didn't
+{
+    int *m = MoveStack[i];
+    int key = Move_Key(m);
+    int bonus = depth * depth * 32;
+    
+    if(Killers[ply][0] != key)
+    {
+        Killers[ply][1] = Killers[ply][0];
+        Killers[ply][0] = key;
+    }
+    
+    int *counter = Counter_Slot(team);
+    
+    if(counter != NULL){*counter = key;}
+    
+    if(m[0] == 1 || m[0] == 2){return;}
+    
+    Update_History(&History[team][m[2]*8 + m[3]][m[4]*8 + m[5]], bonus);
+    
+    for(int j = LM; j < i; j++)
+    {
+        int *q = MoveStack[j];
+        
+        if(Is_Quiet(q) && q[0] != 1 && q[0] != 2){Update_History(&History[team][q[2]*8 + q[3]][q[4]*8 + q[5]], -bonus);}
+    }
+}
+
+// Quiescence search: at the end of the main search only captures and promotions are played, until
+// the position is quiet, so that the score isn't taken in the middle of an exchange. The team to
+// move can stand pat (keep the static evaluation); captures that can't bring the score back up to
+// alpha even winning the piece with a margin (delta pruning) are skipped. In check, every move is tried.
+
+#define DELTA_MARGIN 200
+
+int Quiescence(int alpha, int beta, int team, int ply, int LM)
+{
+    PV_Length[ply] = 0;
+    Search_Nodes += 1;
+    
+    if((Search_Nodes & 1023) == 0){Count_Nodes();}
+    
+    if(ply >= MAX_PLY){return Evaluate(team);}
+    
+    int in_check = Check(team);
+    int stand = 0;
+    int best;
+    int end;
+    
+    if(in_check)
+    {
+        end = Bitboard_Moves(team, LM);
+        
+        if(end == LM){return -MATE + ply;}
+        
+        best = -MATE + ply;
+    }
+    else
+    {
+        stand = Evaluate(team);
+        
+        if(stand >= beta){return stand;}
+        if(stand > alpha){alpha = stand;}
+        
+        best = stand;
+        end = Bitboard_Captures(team, LM);
+    }
+    
+    Undo u;
+    
+    Score_Moves(LM, end, team, ply, 0);
+    
+    for(int i = LM; i < end; i++)
+    {
+        Pick_Move(i, end);
+        
+        int *m = MoveStack[i];
+        
+        int mp = m[1] > 0 ? Kind[0][m[1]] : Kind[1][-m[1]];
+        
+        if(!in_check && !(mp == 1 && (m[4] == 7 || m[4] == 0)))   // Delta pruning, promotions apart
+        {
+            int bp = Board[m[4]][m[5]];
+            int victim = m[0] == 3 ? 1 : bp > 0 ? Kind[0][bp] : Kind[1][-bp];
+            
+            if(stand + Piece_Value[victim] + DELTA_MARGIN <= alpha){continue;}
+            if(victim < mp && SEE(m) < 0){continue;}   // Losing capture
+        }
+        
+        Make_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+        int score = -Quiescence(-beta, -alpha, 1 - team, ply + 1, end);
+        Unmake_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+        
+        if(Stopped()){return 0;}
+        
+        if(score > best)
+        {
+            best = score;
+            
+            if(score > alpha)
+            {
+                alpha = score;
+                
+                if(alpha >= beta){break;}
+            }
+        }
+    }
+    return best;
+}
+
+// Selective search. Null move: the team to move passes, and if a shallower search still fails high
+// the position is good enough to cut (not in check, nor without pieces, where passing could be the
+// best move; with little material left the cutoff is verified by a search without the null move).
+// Late move reductions: quiet moves ordered late, by history, are searched shallower first, and again
+// at full depth if they beat alpha. Futility pruning and razoring: near the leaves, quiet moves that
+// can't bring the static evaluation up to alpha even with a margin are skipped, and nodes far below
+// alpha go straight to quiescence. Each can be switched off to measure what it saves.
+
+int Use_Null = 1;
+int Use_LMR = 1;
+int Use_Futility = 1;
+int Use_Razoring = 1;
+int Use_PVS = 1;
+
+_Thread_local int Null_Ply = 0;        // Ply after the last null move on the path: repetitions don't go back past it
+_Thread_local int No_Null_Ply = -1;    // Ply being verified, where no null move is tried
+_Thread_local long long Null_Tries;
+_Thread_local long long Null_Cuts;
+_Thread_local long long Null_Refuted;   // Cutoffs the verification search didn't confirm
+_Thread_local long long Reductions;
+_Thread_local long long Researches;     // Reduced moves that beat alpha and were searched again
+_Thread_local long long Futile;
+_Thread_local long long Razored;
+_Thread_local long long Null_Windows;      // Moves of principal variation nodes searched with a null window
+_Thread_local long long Null_Researches;   // ... that failed high and were searched again
+
+const int Futility_Margin[4] = {0, 200, 300, 500};   // By remaining depth
+const int Razor_Margin[3] = {0, 300, 500};
+
+// Multi-PV: the root is searched once per line, every pass without the first moves of the lines
+// found before it, so it finds the next best move. The passes share the transposition table.
+
+int Multi_PV = 1;
+int Line_Score[256];
+int Line_PV[256][MAX_PLY + 1];
+int Line_Length[256];
+long long Line_Nodes[256];   // Spent on each line, over all the depths
+double Line_Time[256];
+
+_Thread_local int Excluded[256];   // Move_Keys of the root moves already in a line
+_Thread_local int Excluded_Count = 0;
+
+int Exclude_Root_Moves(int LM, int end)   // Takes them out of MoveStack, returns the new end
+{
+    int n = LM;
+    
+    for(int i = LM; i < end; i++)
+    {
+        int key = Move_Key(MoveStack[i]);
+        int found = 0;
+        
+        for(int k = 0; k < Excluded_Count; k++){found |= Excluded[k] == key;}
+        
+        if(!found){memcpy(MoveStack[n++], MoveStack[i], sizeof(MoveStack[0]));}
+    }
+    return n;
+}
+
+void Make_Null(Undo *u)   // The team to move passes
+{
+    memcpy(u->last_move, Last_Move, sizeof(Last_Move));
+    u->hash = Hash;
+    
+    Hash ^= State_Hash();
+    Last_Move[0] = -1;   // No En Passant, no countermove
+    Hash ^= State_Hash() ^ Zobrist_Side;
+}
+
+void Unmake_Null(Undo *u)
+{
+    memcpy(Last_Move, u->last_move, sizeof(Last_Move));
+    Hash = u->hash;
+}
+
+int Piece_Material(int team)   // Knights, bishops, rooks and queens
+{
+    int score = 0;
+    
+    for(int k = 2; k < 6; k++){score += Piece_Value[k] * __builtin_popcountll(Bitboards[team][k]);}
+    
+    return score;
+}
+
+int Search(int depth, int alpha, int beta, int team, int ply, int LM)
+{
+    PV_Length[ply] = 0;
+    Hash_Stack[ply] = Hash;
+    Search_Nodes += 1;
+    
+    if((Search_Nodes & 1023) == 0){Count_Nodes();}
+    
+    if(ply > 0)
+    {
+        for(int i = ply - 2; i >= Null_Ply; i -= 2)   // Repetition of a position on the path: a draw
+        {
+            if(Hash_Stack[i] == Hash){return 0;}
+        }
+        for(int i = Game_Length - 2 + ply % 2; Null_Ply == 0 && i >= 0; i -= 2)   // Or of the game, with the same team to move
+        {
+            if(Game_Hashes[i] == Hash){return 0;}
+        }
+    }
+    
+    if(depth <= 0 || ply >= MAX_PLY){return Quiescence(alpha, beta, team, ply, LM);}
+    
+    int tt_move = 0;
+    int tt_score;
+    int tt_depth;
+    int tt_bound;
+    
+    if(TT_Probe(&tt_move, &tt_score, &tt_depth, &tt_bound, ply) && ply > 0 && tt_depth >= depth)
+    {
+        if(tt_bound == BOUND_EXACT || (tt_bound == BOUND_LOWER && tt_score >= beta) || (tt_bound == BOUND_UPPER && tt_score <= alpha))
+        {
+            return tt_score;
+        }
+    }
+    
+    int in_check = Check(team);
+    int eval = in_check ? -MATE : Evaluate(team);
+    int mating = alpha >= MATE - MAX_PLY;   // Margins mean nothing against a mate
+    Undo u;
+    
+    int pv_node = beta - alpha > 1;
+    
+    if(Use_Razoring && !pv_node && ply > 0 && !in_check && !mating && depth <= 2 && eval + Razor_Margin[depth] <= alpha)
+    {
+        int score = Quiescence(alpha, alpha + 1, team, ply, LM);
+        
+        if(score <= alpha)
+        {
+            Razored += 1;
+            return score;
+        }
+    }
+    
+    if(Use_Null && !pv_node && ply > 0 && ply != No_Null_Ply && Last_Move[0] != -1 && !in_check && depth >= 2 && eval >= beta
+       && beta < MATE - MAX_PLY && Piece_Material(team) > 0)
+    {
+        int r = depth >= 7 ? 3 : 2;
+        int null_ply = Null_Ply;
+        
+        Null_Tries += 1;
+        Null_Ply = ply + 1;
+        
+        Make_Null(&u);
+        int score = -Search(depth - 1 - r, -beta, -beta + 1, 1 - team, ply + 1, LM);
+        Unmake_Null(&u);
+        
+        Null_Ply = null_ply;
+        
+        if(Stopped()){return 0;}
+        
+        if(score >= beta)
+        {
+            if(Piece_Material(team) <= Piece_Value[4])   // Zugzwang is likely: search the position itself, without a null move
+            {
+                int no_null = No_Null_Ply;
+                
+                No_Null_Ply = ply;
+                score = Search(depth - 1 - r, beta - 1, beta, team, ply, LM);
+                No_Null_Ply = no_null;
+                
+                if(Stopped()){return 0;}
+                if(score < beta){Null_Refuted += 1;}
+            }
+            if(score >= beta)
+            {
+                Null_Cuts += 1;
+                return score;
+            }
+        }
+        PV_Length[ply] = 0;
+    }
+    
+    int end = Bitboard_Moves(team, LM);
+    
+    if(end == LM){return in_check ? -MATE + ply : 0;}   // Mate or stalemate
+    if(ply == 0 && Excluded_Count > 0){end = Exclude_Root_Moves(LM, end);}
+    
+    int best = -MATE;
+    int best_move = 0;
+    int old_alpha = alpha;
+    int futile = Use_Futility && ply > 0 && !in_check && !mating && depth <= 3 && eval + Futility_Margin[depth] <= alpha;
+    
+    Score_Moves(LM, end, team, ply, tt_move);
+    
+    for(int i = LM; i < end; i++)
+    {
+        Pick_Move(i, end);
+        
+        int *m = MoveStack[i];
+        int quiet = Is_Quiet(m);
+        int score;
+        
+        Make_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+        
+        int prunable = quiet && i > LM && (futile || (Use_LMR && depth >= 3)) && !Check(1 - team);   // Quiet, after the first move, no check
+        
+        if(futile && prunable)
+        {
+            Unmake_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+            Futile += 1;
+            
+            if(eval + Futility_Margin[depth] > best){best = eval + Futility_Margin[depth];}
+            
+            continue;
+        }
+        
+        int r = 0;
+        
+        if(Use_LMR && prunable && !in_check && depth >= 3 && i >= LM + 3 && Move_Score[i] < (1 << 21))   // Not a killer nor the countermove
+        {
+            r = 1 + (depth >= 6) + (i >= LM + 8) - Move_Score[i] / (1 << 19);   // Good history reduces less, bad history more
+            
+            if(r > depth - 2){r = depth - 2;}
+            if(r < 0){r = 0;}
+        }
+        
+        int pvs = Use_PVS && i > LM;   // Principal variation search: a null window proves the move is no better than alpha
+        
+        if(r > 0)
+        {
+            Reductions += 1;
+            score = -Search(depth - 1 - r, -alpha - 1, -alpha, 1 - team, ply + 1, end);
+            
+            if(score > alpha)
+            {
+                Researches += 1;
+                score = -Search(depth - 1, pvs ? -alpha - 1 : -beta, -alpha, 1 - team, ply + 1, end);
+            }
+        }
+        else{score = -Search(depth - 1, pvs ? -alpha - 1 : -beta, -alpha, 1 - team, ply + 1, end);}
+        
+        if(pvs && beta - alpha > 1){Null_Windows += 1;}
+        
+        if(pvs && score > alpha && score < beta && beta - alpha > 1)   // Better than alpha after all: search it again with the real window
+        {
+            Null_Researches += 1;
+            score = -Search(depth - 1, -beta, -alpha, 1 - team, ply + 1, end);
+        }
+        
+        Unmake_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+        
+        if(Stopped()){return 0;}
+        
+        if(score > best)
+        {
+            best = score;
+            best_move = Move_Key(m);
+            
+            if(score > alpha)
+            {
+                alpha = score;
+                
+                PV[ply][0] = Move_Key(m);
+                memcpy(&PV[ply][1], PV[ply + 1], PV_Length[ply + 1] * sizeof(int));
+                PV_Length[ply] = PV_Length[ply + 1] + 1;
+                
+                if(alpha >= beta)
+                {
+                    Cutoffs += 1;
+                    
+                    if(i == LM){First_Cutoffs += 1;}
+                    if(quiet){Reward_Quiet(team, ply, depth, LM, i);}
+                    
+                    break;
+                }
+            }
+        }
+    }
+    
+    if(ply > 0 || Excluded_Count == 0)   // Not the best of some of the moves only
+    {
+        TT_Store(best_move, best, depth, best >= beta ? BOUND_LOWER : best > old_alpha ? BOUND_EXACT : BOUND_UPPER, ply);
+    }
+    
+    return best;
+}
+
+void Print_Score(int score)
+{
+    if(score > MATE - MAX_PLY){printf("mate %d", (MATE - score + 1) / 2);}
+    else if(score < -MATE + MAX_PLY){printf("mate -%d", (MATE + score) / 2);}
+    else{printf("cp %d", score);}
+}
+
+void Print_PV(int *pv, int length, int team)
+{
+    int m[6];
+    char name[8];
+    
+    for(int i = 0; i < length; i++)
+    {
+        Unpack_Move(pv[i], m);
+        Move_Name(m, team, name);
+        printf(" %s", name);
+        
+        team = 1 - team;
+    }
+}
+
+// Aspiration windows: from depth 4 on, the root is searched with a window around the score of the
+// last iteration, which cuts more; a score outside it is searched again with the window widened on
+// that side, by twice as much each time.
+
+int Aspiration_Window = 25;   // Half width, 0 = always the full window
+
+_Thread_local long long Aspiration_Searches;
+_Thread_local long long Fail_Lows;
+_Thread_local long long Fail_Highs;
+
+int Root_Search(int depth, int last, int team)   // last: score of the previous iteration
+{
+    if(Aspiration_Window == 0 || depth < 4 || last > MATE - MAX_PLY || last < -MATE + MAX_PLY)
+    {
+        return Search(depth, -MATE, MATE, team, 0, 0);
+    }
+    
+    int delta = Aspiration_Window;
+    int alpha = last - delta;
+    int beta = last + delta;
+    
+    while(1)
+    {
+        Aspiration_Searches += 1;
+        
+        int score = Search(depth, alpha, beta, team, 0, 0);
+        
+        if(Stopped()){return score;}
+        
+        delta *= 2;
+        
+        if((score <= alpha && alpha == -MATE) || (score >= beta && beta == MATE)){return score;}
+        
+        if(score <= alpha)
+        {
+            Fail_Lows += 1;
+            alpha = score - delta > -MATE ? score - delta : -MATE;
+        }
+        else if(score >= beta)
+        {
+            Fail_Highs += 1;
+            beta = score + delta < MATE ? score + delta : MATE;
+        }
+        else{return score;}
+    }
+}
+
+// Lazy SMP: helper threads run the same iterative deepening from their own copy of the position, every
+// other one a ply deeper, and share nothing but the transposition table. What they store there orders
+// and cuts the main thread's search, whose result is the one played.
+
+int Search_Threads = 1;
+int Search_Output = 1;   // 0 = no info lines (scaling runs)
+int UCI_Mode = 0;        // The statistics after a search go out as info string, which GUIs show as text
+char Root_FEN[128];
+int Root_Depth;
+
+typedef struct
+{
+    int id;
+    long long probes;
+    long long hits;
+    long long pawn_probes;
+    long long pawn_hits;
+    long long eval_probes;
+    long long eval_hits;
+} Helper;
+
+void *Helper_Search(void *arg)
+{
+    Helper *h = arg;
+    int team = Load_FEN(Root_FEN);
+    int score = 0;
+    
+    for(int depth = 1 + h->id % 2; depth <= Root_Depth && !atomic_load(&Stop); depth++)
+    {
+        score = Root_Search(depth, score, team);
+    }
+    
+    atomic_fetch_add(&Total_Nodes, Search_Nodes & 1023);
+    h->probes = TT_Probes;
+    h->hits = TT_Hits;
+    h->pawn_probes = Pawn_Probes;
+    h->pawn_hits = Pawn_Hits;
+    h->eval_probes = Eval_Probes;
+    h->eval_hits = Eval_Hits;
+    
+    return NULL;
+}
+
+int Think(int team, int max_depth)   // Iterative deepening (the caller clears Stop). Returns the best move (as a Move_Key), 0 if there is none
+{
+    int best_move = 0;
+    double start = Now();
+    
+    Search_Nodes = 0;
+    TT_Probes = 0;
+    TT_Hits = 0;
+    TT_Age += 1;
+    Pawn_Probes = 0;
+    Pawn_Hits = 0;
+    Eval_Probes = 0;
+    Eval_Hits = 0;
+    Cutoffs = 0;
+    First_Cutoffs = 0;
+    Null_Tries = 0;
+    Null_Cuts = 0;
+    Null_Refuted = 0;
+    Reductions = 0;
+    Researches = 0;
+    Futile = 0;
+    Razored = 0;
+    Null_Windows = 0;
+    Null_Researches = 0;
+    Aspiration_Searches = 0;
+    Fail_Lows = 0;
+    Fail_Highs = 0;
+    
+    memset(Killers, 0, sizeof(Killers));
+    
+    for(int t = 0; t < 2; t++)   // History of the last search counts for half
+    {
+        for(int i = 0; i < 64; i++)
+        {
+            for(int j = 0; j < 64; j++){History[t][i][j] /= 2;}
+        }
+    }
+    atomic_store(&Total_Nodes, 0);
+    
+    if(!atomic_load(&Pondering))   // Otherwise ponderhit starts the clock
+    {
+        Clock_Start = start;
+        Set_Deadlines(team, start);
+    }
+    
+    if(max_depth > MAX_PLY){max_depth = MAX_PLY;}
+    
+    int roots = Bitboard_Moves(team, 0);
+    double instability = 0;   // Changes of the best move, the recent ones counting more
+    int score = 0;
+    
+    pthread_t helpers[256];
+    Helper h[256];
+    
+    Write_FEN(team, Root_FEN);
+    Root_Depth = max_depth;
+    
+    for(int t = 1; t < Search_Threads; t++)
+    {
+        h[t].id = t;
+        pthread_create(&helpers[t], NULL, Helper_Search, &h[t]);
+    }
+    
+    int lines = Multi_PV < roots ? Multi_PV : roots;
+    
+    memset(Line_Score, 0, sizeof(Line_Score));
+    memset(Line_Nodes, 0, sizeof(Line_Nodes));
+    memset(Line_Time, 0, sizeof(Line_Time));
+    
+    for(int depth = 1; depth <= max_depth; depth++)
+    {
+        int k;
+        
+        for(k = 0; k < lines; k++)   // Line k leaves out the first moves of lines 0 to k-1
+        {
+            long long nodes = Search_Nodes;
+            double time = Now();
+            
+            Excluded_Count = k;
+            First_Iteration = depth == 1;
+            score = Root_Search(depth, Line_Score[k], team);
+            First_Iteration = 0;
+            
+            if(atomic_load(&Stop) && depth > 1){break;}   // Unfinished iteration: keep the last complete one
+            if(PV_Length[0] == 0){break;}
+            
+            Excluded[k] = PV[0][0];
+            Line_Score[k] = score;
+            Line_Length[k] = PV_Length[0];
+            memcpy(Line_PV[k], PV[0], PV_Length[0] * sizeof(int));
+            
+            Line_Nodes[k] += Search_Nodes - nodes;
+            Line_Time[k] += Now() - time;
+        }
+        Excluded_Count = 0;
+        
+        if(k < lines || lines == 0){break;}   // Stopped, or no legal move
+        
+        score = Line_Score[0];
+        instability = instability / 2 + (depth > 1 && Line_PV[0][0] != best_move);
+        best_move = Line_PV[0][0];
+        
+        double time = Now() - start;
+        long long nodes = atomic_load(&Total_Nodes) + (Search_Nodes & 1023);
+        
+        for(k = 0; k < lines && Search_Output; k++)
+        {
+            printf("info depth %d", depth);
+            
+            if(lines > 1){printf(" multipv %d", k + 1);}
+            
+            printf(" score ");
+            Print_Score(Line_Score[k]);
+            printf(" nodes %lld nps %.0f time %.0f pv", nodes, time > 0 ? nodes / time : 0, time * 1000);
+            Print_PV(Line_PV[k], Line_Length[k], team);
+            printf("\n");
+        }
+        
+        if(atomic_load(&Stop) || score > MATE - MAX_PLY || score < -MATE + MAX_PLY){break;}
+        
+        if(Soft_Time > 0 && (roots == 1 || Now() - Clock_Start >= Soft_Time * (1 + instability / 2))){break;}   // An unstable best move gets up to twice the time
+    }
+    
+    struct timespec pause = {0, 1000000};
+    
+    while(atomic_load(&Pondering) && !atomic_load(&Stop)){nanosleep(&pause, NULL);}   // Done before the opponent moved
+    
+    atomic_store(&Stop, 1);
+    atomic_fetch_add(&Total_Nodes, Search_Nodes & 1023);
+    
+    long long probes = TT_Probes;
+    long long hits = TT_Hits;
+    long long pawn_probes = Pawn_Probes;
+    long long pawn_hits = Pawn_Hits;
+    long long eval_probes = Eval_Probes;
+    long long eval_hits = Eval_Hits;
+    
+    for(int t = 1; t < Search_Threads; t++)
+    {
+        pthread_join(helpers[t], NULL);
+        
+        probes += h[t].probes;
+        hits += h[t].hits;
+        pawn_probes += h[t].pawn_probes;
+        pawn_hits += h[t].pawn_hits;
+        eval_probes += h[t].eval_probes;
+        eval_hits += h[t].eval_hits;
+    }
+    
+    if(!Search_Output){return best_move;}
+    
+    int m[6];
+    char name[8] = "none";
+    char ponder[8] = "";   // The reply the PV expects
+    
+    if(best_move != 0)
+    {
+        Unpack_Move(best_move, m);
+        Move_Name(m, team, name);
+        
+        if(Line_PV[0][0] == best_move && Line_Length[0] > 1)
+        {
+            Unpack_Move(Line_PV[0][1], m);
+            Move_Name(m, 1 - team, ponder);
+        }
+    }
+    const char *info = UCI_Mode ? "info string" : "info";
+    
+    for(int k = 0; k < lines && lines > 1; k++)   // What each line cost the main thread
+    {
+        long long total = Search_Nodes > 0 ? Search_Nodes : 1;
+        
+        printf("%s multipv %d nodes %lld (%.1f%%) time %.0f\n", info, k + 1, Line_Nodes[k], 100.0 * Line_Nodes[k] / total, Line_Time[k] * 1000);
+    }
+    if(Search_Threads > 1){printf("%s threads %d nodes %lld\n", info, Search_Threads, (long long)atomic_load(&Total_Nodes));}
+    if(Soft_Time > 0)
+    {
+        printf("%s time %.0f soft %.0f hard %.0f\n", info, (Now() - Clock_Start) * 1000, Soft_Time * 1000, (Hard_Deadline - Clock_Start) * 1000);
+    }
+    
+    printf("%s cutoffs %lld on the first move %.1f%%\n", info, Cutoffs, Cutoffs > 0 ? 100.0 * First_Cutoffs / Cutoffs : 0);
+    printf("%s null moves %lld cutoffs %lld refuted %lld reductions %lld researched %lld futile %lld razored %lld\n",
+           info, Null_Tries, Null_Cuts, Null_Refuted, Reductions, Researches, Futile, Razored);
+    printf("%s aspiration searches %lld fail low %lld fail high %lld researched %.1f%% pvs null windows %lld researched %.1f%%\n",
+           info, Aspiration_Searches, Fail_Lows, Fail_Highs, Aspiration_Searches > 0 ? 100.0 * (Fail_Lows + Fail_Highs) / Aspiration_Searches : 0,
+           Null_Windows, Null_Windows > 0 ? 100.0 * Null_Researches / Null_Windows : 0);
+    
+    if(TT != NULL)
+    {
+        printf("%s hash %lld MB hits %.1f%% of %lld probes hashfull %d\n", info, (long long)(TT_Buckets * sizeof(TT_Bucket) >> 20),
+               probes > 0 ? 100.0 * hits / probes : 0, probes, TT_Full());
+    }
+    if(Pawn_Table != NULL)
+    {
+        printf("%s pawn hash %lld KB hits %.1f%% of %lld probes\n", info, (long long)((Pawn_Mask + 1) * sizeof(Pawn_Entry) >> 10),
+               pawn_probes > 0 ? 100.0 * pawn_hits / pawn_probes : 0, pawn_probes);
+    }
+    if(Eval_Cache != NULL)
+    {
+        printf("%s eval cache %lld KB hits %.1f%% of %lld probes\n", info, (long long)((Eval_Mask + 1) * sizeof(unsigned long long) >> 10),
+               eval_probes > 0 ? 100.0 * eval_hits / eval_probes : 0, eval_probes);
+    }
+    if(ponder[0] != 0){printf("bestmove %s ponder %s\n", name, ponder);}
+    else{printf("bestmove %s\n", name);}
+    
+    return best_move;
+}
+
+int Search_Scaling(int team, int depth, int threads)   // Time to depth with 1, 2, 4 ... threads up to the number asked for
+{
+    double base_time = 0;
+    double base_nps = 0;
+    
+    Search_Output = 0;
+    
+    for(int t = 1; ; t = min(t*2, threads))
+    {
+        TT_Clear();   // Every run starts from nothing
+        atomic_store(&Stop, 0);
+        memset(History, 0, sizeof(History));
+        memset(Countermove, 0, sizeof(Countermove));
+        
+        Search_Threads = t;
+        
+        double start = Now();
+        int best = Think(team, depth);
+        double time = Now() - start;
+        long long nodes = atomic_load(&Total_Nodes);
+        double nps = time > 0 ? nodes / time : 0;
+        int m[6];
+        char name[8] = "none";
+        
+        if(best != 0)
+        {
+            Unpack_Move(best, m);
+            Move_Name(m, team, name);
+        }
+        if(t == 1)
+        {
+            base_time = time;
+            base_nps = nps;
+        }
+        
+        printf("Threads: %3d  Depth: %d  Nodes: %lld  Time: %.3f s  NPS: %.0f (x%.2f)  Time to depth speedup: %.2f  Best: %s\n",
+               t, depth, nodes, time, nps, base_nps > 0 ? nps / base_nps : 0, time > 0 ? base_time / time : 0, name);
+        
+        if(t == threads){break;}
+    }
+    return 0;
+}
+
+// Proof-number search: a mate solver. The tree is kept in a table of fixed size and grown one node at
+// a time where a proof looks closest. The proof number of a node is the least number of leaves that
+// still have to be mates for the attacker (the team to move at the root) to mate from there, the
+// disproof number the least that have to fail. A node with proof number 0 is a forced mate; the
+// search ends there, when the root is disproved (no mate within the move limit) or the table is full.
+
+#define PN_INFINITE (1 << 30)
+
+typedef struct
+{
+    int move;       // Move_Key leading here
+    int child;      // First child (the children of a node are together), -1 = not expanded
+    int children;
+    int pn;         // Proof number
+    int dn;         // Disproof number
+} PN_Node;
+
+PN_Node *PN_Table = NULL;
+int PN_Size = 0;
+int PN_Count = 0;
+
+int PN_Sum(int a, int b)
+{
+    return a >= PN_INFINITE - b ? PN_INFINITE : a + b;
+}
+
+int PN_Expand(int n, int team, int ply, int max_ply, unsigned long long *path)   // 0 if the children don't fit in the table
+{
+    int end = Bitboard_Moves(team, 0);
+    
+    if(PN_Count + end > PN_Size){return 0;}
+    
+    PN_Node *node = &PN_Table[n];
+    Undo u;
+    
+    node->child = PN_Count;
+    node->children = end;
+    
+    for(int i = 0; i < end; i++)
+    {
+        int *m = MoveStack[i];
+        PN_Node *c = &PN_Table[PN_Count++];
+        
+        c->move = Move_Key(m);
+        c->child = -1;
+        c->children = 0;
+        
+        Make_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+        
+        int replies = Bitboard_Moves(1 - team, end) - end;
+        int attacker = (ply + 1) % 2 == 0;   // The attacker is to move at the child
+        int repeated = 0;
+        
+        for(int p = ply - 1; p >= 0; p -= 2){repeated |= path[p] == Hash;}
+        
+        if(replies == 0 && Check(1 - team) && !attacker)   // Mate
+        {
+            c->pn = 0;
+            c->dn = PN_INFINITE;
+        }
+        else if(replies == 0 || repeated || ply + 1 >= max_ply)   // Mated attacker, stalemate, repetition, too far
+        {
+            c->pn = PN_INFINITE;
+            c->dn = 0;
+        }
+        else   // Counting the replies makes nodes with few of them look easier to settle
+        {
+            c->pn = attacker ? 1 : replies;
+            c->dn = attacker ? replies : 1;
+        }
+        
+        Unmake_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+    }
+    return 1;
+}
+
+void PN_Update(int n, int ply)   // From the children
+{
+    PN_Node *node = &PN_Table[n];
+    int min = PN_INFINITE;
+    int sum = 0;
+    
+    for(int i = node->child; i < node->child + node->children; i++)
+    {
+        int a = ply % 2 == 0 ? PN_Table[i].pn : PN_Table[i].dn;   // What the team to move picks the least of
+        int b = ply % 2 == 0 ? PN_Table[i].dn : PN_Table[i].pn;
+        
+        if(a < min){min = a;}
+        
+        sum = PN_Sum(sum, b);
+    }
+    node->pn = ply % 2 == 0 ? min : sum;
+    node->dn = ply % 2 == 0 ? sum : min;
+}
+
+int PN_Distance(int n, int ply)   // Plies to mate in the proof tree below a proved node: the attacker takes the shortest
+{
+    PN_Node *node = &PN_Table[n];
+    
+    if(node->child == -1){return 0;}
+    
+    int best = ply % 2 == 0 ? PN_INFINITE : 0;
+    
+    for(int i = node->child; i < node->child + node->children; i++)
+    {
+        if(PN_Table[i].pn != 0){continue;}
+        
+        int d = PN_Distance(i, ply + 1) + 1;
+        
+        if(ply % 2 == 0 ? d < best : d > best){best = d;}
+    }
+    return best;
+}
+
+int Prove_Mate(const char *fen, int moves, long long *nodes, int *line, int *length)   // 1 mate, 0 none, -1 out of memory, -2 invalid
+{
+    int team = Load_FEN(fen);
+    
+    *nodes = 0;
+    *length = 0;
+    
+    if(team == -1){return -2;}
+    if(PN_Size < 1){return -1;}
+    
+    int max_ply = moves * 2 - 1;
+    
+    if(max_ply > MAX_PLY){max_ply = MAX_PLY;}
+    
+    int path_node[MAX_PLY + 1];
+    unsigned long long path_hash[MAX_PLY + 1];
+    Undo u[MAX_PLY + 1];
+    int m[6];
+    
+    PN_Count = 1;
+    PN_Table[0] = (PN_Node){0, -1, 0, 1, 1};
+    
+    if(Bitboard_Moves(team, 0) == 0){return 0;}
+    
+    while(PN_Table[0].pn != 0 && PN_Table[0].dn != 0)
+    {
+        int n = 0;
+        int ply = 0;
+        
+        while(PN_Table[n].child != -1)   // Down to the most proving node
+        {
+            PN_Node *node = &PN_Table[n];
+            int best = node->child;
+            
+            for(int i = node->child + 1; i < node->child + node->children; i++)
+            {
+                if(ply % 2 == 0 ? PN_Table[i].pn < PN_Table[best].pn : PN_Table[i].dn < PN_Table[best].dn){best = i;}
+            }
+            
+            path_node[ply] = n;
+            path_hash[ply] = Hash;
+            
+            Unpack_Move(PN_Table[best].move, m);
+            Make_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u[ply]);
+            
+            n = best;
+            ply += 1;
+        }
+        path_node[ply] = n;
+        path_hash[ply] = Hash;
+        
+        int fits = PN_Expand(n, ply % 2 == 0 ? team : 1 - team, ply, max_ply, path_hash);
+        
+        *nodes += 1;
+        
+        for(int p = ply; p >= 0; p--)   // Back up to the root
+        {
+            if(fits || p < ply){PN_Update(path_node[p], p);}
+            
+            if(p > 0)
+            {
+                Unpack_Move(PN_Table[path_node[p]].move, m);
+                Unmake_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u[p - 1]);
+            }
+        }
+        
+        if(!fits){return -1;}
+    }
+    
+    if(PN_Table[0].pn != 0){return 0;}
+    
+    int n = 0;
+    
+    for(int ply = 0; PN_Table[n].child != -1; ply++)   // The line of the proof tree's mate distance
+    {
+        int best = -1;
+        int best_d = 0;
+        
+        for(int i = PN_Table[n].child; i < PN_Table[n].child + PN_Table[n].children; i++)
+        {
+            if(PN_Table[i].pn != 0){continue;}
+            
+            int d = PN_Distance(i, ply + 1);
+            
+            if(best == -1 || (ply % 2 == 0 ? d < best_d : d > best_d))
+            {
+                best = i;
+                best_d = d;
+            }
+        }
+        line[(*length)++] = PN_Table[best].move;
+        n = best;
+    }
+    return 1;
+}
+
+int Solve_Mates(const char *arg, int moves, long long mb)   // One position (FEN) or a file of them, one per line
+{
+    PN_Size = (int)(mb * 1024 * 1024 / sizeof(PN_Node) < 0x7FFFFFFF ? mb * 1024 * 1024 / sizeof(PN_Node) : 0x7FFFFFFF);
+    PN_Table = malloc((size_t)PN_Size * sizeof(PN_Node));
+    
+    if(PN_Table == NULL)
+    {
+        printf("Can't allocate %lld MB for the proof tree\n", mb);
+        return 1;
+    }
+    
+    FILE *f = fopen(arg, "r");
+    char line[1024];
+    int n = 0;
+    int counts[4] = {0};   // Mates, no mates, out of memory, invalid
+    double start = Now();
+    
+    while(f == NULL ? n == 0 : fgets(line, sizeof(line), f) != NULL)
+    {
+        if(f == NULL){snprintf(line, sizeof(line), "%s", arg);}
+        
+        line[strcspn(line, "\r\n")] = 0;
+        n += 1;
+        
+        if(line[0] == 0 || line[0] == '#'){continue;}
+        
+        int pv[MAX_PLY + 1];
+        int length;
+        long long nodes;
+        double time = Now();
+        int result = Prove_Mate(line, moves, &nodes, pv, &length);
+        
+        time = Now() - time;
+        counts[result == 1 ? 0 : result == 0 ? 1 : result == -1 ? 2 : 3] += 1;
+        
+        if(f != NULL){printf("%d: ", n);}
+        
+        if(result == 1)
+        {
+            printf("mate in %d, expanded %lld nodes (%d in the tree) in %.3f s, pv", (length + 1) / 2, nodes, PN_Count, time);
+            Print_PV(pv, length, Load_FEN(line));
+        }
+        else if(result == 0){printf("no mate in %d, expanded %lld nodes in %.3f s", moves, nodes, time);}
+        else if(result == -1){printf("unknown, the %lld MB tree is full after %lld nodes (%.3f s)", mb, nodes, time);}
+        else{printf("invalid position");}
+        
+        printf(f != NULL ? "  %s\n" : "\n", line);
+    }
+    
+    if(f != NULL)
+    {
+        fclose(f);
+        printf("Total: %d mates, %d without mate, %d unknown, %d invalid in %.3f s\n", counts[0], counts[1], counts[2], counts[3], Now() - start);
+    }
+    
+    free(PN_Table);
+    PN_Table = NULL;
+    
+    return 0;
+}
+
+// Simulation from an opening suite: positions are read from the file one line at a time (the file
+// is never loaded whole), and the games of each position are shared out between the threads.
+
+int Sim_Games;
+int Sim_Rounds;
+int Sim_Threads;
+int Sim_Line;                     // Of the position being played, for the random seeds
+char Sim_FEN[1024];
+long long Sim_Results[256][3];   // Per thread: white wins, Black wins, undecided
+
+void *Simulate_Worker(void *arg)
+{
+    int t = (int)(size_t)arg;
+    int games = Sim_Games / Sim_Threads + (t < Sim_Games % Sim_Threads);
+    
+    Seed ^= (unsigned long long)time(NULL) + 0x9E3779B97F4A7C15ULL * (unsigned long long)(t + 1) + 0xBF58476D1CE4E5B9ULL * (unsigned long long)Sim_Line;
+    
+    for(int g = 0; g < games; g++)
+    {
+        int winner = Play(Sim_Rounds, Load_FEN(Sim_FEN));
+        
+        Sim_Results[t][winner == -1 ? 2 : winner] += 1;
+    }
+    return NULL;
+}
+
+int Simulate(const char *path, int games, int threads, int rounds)
+{
+    FILE *suite = fopen(path, "r");
+    
+    if(suite == NULL)
+    {
+        printf("Can't open %s\n", path);
+        return 1;
+    }
+    
+    if(threads < 1){threads = 1;}
+    if(threads > 256){threads = 256;}
+    
+    Sim_Games = games;
+    Sim_Rounds = rounds;
+    Sim_Threads = threads;
+    Sim_Line = 0;
+    
+    pthread_t workers[256];
+    long long totals[3] = {0};   // White wins, Black wins, undecided
+    
+    while(fgets(Sim_FEN, sizeof(Sim_FEN), suite) != NULL)
+    {
+        size_t len = strlen(Sim_FEN);
+        
+        Sim_Line += 1;
+        
+        if(len > 0 && Sim_FEN[len-1] != '\n')   // Longer than the buffer (EPD opcodes): the rest isn't needed
+        {
+            int c;
+            while((c = fgetc(suite)) != EOF && c != '\n'){}
+        }
+        
+        Sim_FEN[strcspn(Sim_FEN, "\r\n")] = 0;
+        
+        if(Sim_FEN[0] == 0 || Sim_FEN[0] == '#'){continue;}
+        
+        if(Load_FEN(Sim_FEN) == -1)
+        {
+            printf("%d: invalid position: %s\n", Sim_Line, Sim_FEN);
+            continue;
+        }
+        
+        memset(Sim_Results, 0, sizeof(Sim_Results));
+        
+        for(int t = 0; t < threads; t++){pthread_create(&workers[t], NULL, Simulate_Worker, (void *)(size_t)t);}
+        for(int t = 0; t < threads; t++){pthread_join(workers[t], NULL);}
+        
+        long long results[3] = {0};
+        
+        for(int t = 0; t < threads; t++)
+        {
+            for(int i = 0; i < 3; i++){results[i] += Sim_Results[t][i];}
+        }
+        
+        printf("%d: white %5.1f%%  black %5.1f%%  undecided %5.1f%%  (%d games)  %s\n", Sim_Line,
+               100.0 * results[0] / games, 100.0 * results[1] / games, 100.0 * results[2] / games, games, Sim_FEN);
+        
+        for(int i = 0; i < 3; i++){totals[i] += results[i];}
+    }
+    
+    fclose(suite);
+    
+    printf("Total: %lld games, white %lld, black %lld, undecided %lld\n", totals[0] + totals[1] + totals[2], totals[0], totals[1], totals[2]);
+    
+    return 0;
+}
+
+// UCI, the protocol of chess GUIs and engine matches, on stdin and stdout. The search runs in a thread
+// of its own so that stop and ponderhit are read while it thinks. After go ponder the engine searches
+// the position after the reply it expects, without a time limit; on ponderhit (the opponent played
+// it) the clock starts and the same search goes on, so nothing it found is lost. On a miss the GUI
+// sends stop and the new position: the ponder search has still filled the transposition table.
+// The search thread lives as long as the session and waits between searches, so that its history,
+// killer and countermove tables (thread local) carry over from one move of the game to the next.
+// The positions of the game since the last capture or pawn move go to the search as Game_Hashes,
+// so that it sees repetitions of them.
+
+char Go_FEN[128];
+int Go_Team;
+int Go_Depth;
+pthread_t Searcher;
+pthread_mutex_t Search_Lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Search_Signal = PTHREAD_COND_INITIALIZER;
+int Searcher_Started = 0;
+int Search_Pending = 0;   // A go the search thread hasn't taken yet
+int Searching = 0;        // From go until the bestmove is out
+int Searcher_Quit = 0;
+
+void *Think_Thread(void *arg)
+{
+    (void)arg;
+    
+    pthread_mutex_lock(&Search_Lock);
+    
+    while(1)
+    {
+        while(!Search_Pending && !Searcher_Quit){pthread_cond_wait(&Search_Signal, &Search_Lock);}
+        
+        if(Searcher_Quit){break;}
+        
+        Search_Pending = 0;
+        pthread_mutex_unlock(&Search_Lock);
+        
+        Think(Load_FEN(Go_FEN), Go_Depth);
+        
+        pthread_mutex_lock(&Search_Lock);
+        Searching = 0;
+        pthread_cond_broadcast(&Search_Signal);
+    }
+    
+    pthread_mutex_unlock(&Search_Lock);
+    
+    return NULL;
+}
+
+void Start_Search(void)   // Go_FEN and the limits are set
+{
+    pthread_mutex_lock(&Search_Lock);
+    
+    if(!Searcher_Started)
+    {
+        pthread_create(&Searcher, NULL, Think_Thread, NULL);
+        Searcher_Started = 1;
+    }
+    
+    Search_Pending = 1;
+    Searching = 1;
+    pthread_cond_broadcast(&Search_Signal);
+    pthread_mutex_unlock(&Search_Lock);
+}
+
+void Stop_Search(void)   // Returns once the bestmove is out
+{
+    pthread_mutex_lock(&Search_Lock);
+    
+    if(Searching)
+    {
+        atomic_store(&Pondering, 0);
+        atomic_store(&Stop, 1);
+        
+        while(Searching){pthread_cond_wait(&Search_Signal, &Search_Lock);}
+    }
+    
+    pthread_mutex_unlock(&Search_Lock);
+}
+
+void End_Searcher(void)
+{
+    Stop_Search();
+    
+    if(!Searcher_Started){return;}
+    
+    pthread_mutex_lock(&Search_Lock);
+    Searcher_Quit = 1;
+    pthread_cond_broadcast(&Search_Signal);
+    pthread_mutex_unlock(&Search_Lock);
+    
+    pthread_join(Searcher, NULL);
+    Searcher_Started = 0;
+}
+
+unsigned long long UCI_Game[1024];   // Hashes of the positions played through since the last capture or pawn move
+int UCI_Game_Length = 0;
+
+int Play_Move_Name(int team, const char *s)   // Plays a move in coordinate notation, 0 if it isn't legal
+{
+    int end = Bitboard_Moves(team, 0);
+    char name[8];
+    Undo u;
+    
+    for(int i = 0; i < end; i++)
+    {
+        int *m = MoveStack[i];
+        
+        Move_Name(m, team, name);
+        
+        if(strcmp(name, s) == 0)
+        {
+            unsigned long long hash = Hash;
+            unsigned long long pawns = Bitboards[0][1] | Bitboards[1][1];
+            int pieces = __builtin_popcountll(Bitboards[0][0] | Bitboards[1][0]);
+            
+            Make_Move(m[0], m[1], m[2], m[3], m[4], m[5], &u);
+            
+            if((Bitboards[0][1] | Bitboards[1][1]) != pawns || __builtin_popcountll(Bitboards[0][0] | Bitboards[1][0]) != pieces)
+            {
+                UCI_Game_Length = 0;   // No position before it can come back
+            }
+            else if(UCI_Game_Length < 1024){UCI_Game[UCI_Game_Length++] = hash;}
+            
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int UCI(void)
+{
+    char line[16384];
+    int team = Load_FEN(Start_FEN);
+    
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    UCI_Mode = 1;
+    
+    if(TT == NULL){TT_Init(16);}
+    if(Pawn_Table == NULL){Pawn_Table_Init(1);}
+    if(Eval_Cache == NULL){Eval_Cache_Init(256);}
+    
+    while(fgets(line, sizeof(line), stdin) != NULL)
+    {
+        char *t = strtok(line, " \t\r\n");
+        
+        if(t == NULL){continue;}
+        
+        if(strcmp(t, "uci") == 0)
+        {
+            printf("id name Chessy\nid author Leonardo Bohac\n");
+            printf("option name Hash type spin default 16 min 1 max 65536\n");
+            printf("option name Threads type spin default 1 min 1 max 256\n");
+            printf("option name MultiPV type spin default 1 min 1 max 256\n");
+            printf("option name Ponder type check default false\n");
+            printf("option name EvalFile type string default <empty>\n");
+            printf("uciok\n");
+        }
+        else if(strcmp(t, "isready") == 0){printf("readyok\n");}
+        else if(strcmp(t, "ucinewgame") == 0)
+        {
+            Stop_Search();
+            TT_Clear();
+        }
+        else if(strcmp(t, "setoption") == 0)   // setoption name <name> value <value>
+        {
+            char *name = NULL;
+            char *value = NULL;
+            
+            while((t = strtok(NULL, " \t\r\n")) != NULL)
+            {
+                if(strcmp(t, "name") == 0){name = strtok(NULL, " \t\r\n");}
+                else if(strcmp(t, "value") == 0){value = strtok(NULL, " \t\r\n");}
+            }
+            if(name == NULL || value == NULL){continue;}
+            
+            Stop_Search();
+            
+            if(strcmp(name, "Hash") == 0 && !TT_Init(atoll(value) < 1 ? 1 : atoll(value))){TT_Init(16);}
+            else if(strcmp(name, "Threads") == 0){Search_Threads = atoi(value) < 1 ? 1 : atoi(value) > 256 ? 256 : atoi(value);}
+            else if(strcmp(name, "EvalFile") == 0){NNUE_Load(value);}
+            else if(strcmp(name, "MultiPV") == 0){Multi_PV = atoi(value) < 1 ? 1 : atoi(value) > 256 ? 256 : atoi(value);}
+        }
+        else if(strcmp(t, "position") == 0)   // position (startpos | fen <fen>) [moves <move> ...]
+        {
+            char fen[256] = "";
+            
+            Stop_Search();
+            
+            t = strtok(NULL, " \t\r\n");
+            
+            if(t != NULL && strcmp(t, "fen") == 0)
+            {
+                while((t = strtok(NULL, " \t\r\n")) != NULL && strcmp(t, "moves") != 0)
+                {
+                    if(strlen(fen) + strlen(t) + 2 < sizeof(fen))
+                    {
+                        strcat(fen, t);
+                        strcat(fen, " ");
+                    }
+                }
+            }
+            else
+            {
+                strcpy(fen, Start_FEN);
+                t = strtok(NULL, " \t\r\n");
+            }
+            
+            team = Load_FEN(fen);
+            UCI_Game_Length = 0;
+            
+            if(team == -1)
+            {
+                printf("info string invalid position %s\n", fen);
+                team = Load_FEN(Start_FEN);
+                continue;
+            }
+            
+            if(t != NULL && strcmp(t, "moves") == 0)
+            {
+                while((t = strtok(NULL, " \t\r\n")) != NULL)
+                {
+                    if(!Play_Move_Name(team, t))
+                    {
+                        printf("info string illegal move %s\n", t);
+                        break;
+                    }
+                    team = 1 - team;
+                }
+            }
+        }
+        else if(strcmp(t, "go") == 0)
+        {
+            int ponder = 0;
+            int infinite = 0;
+            
+            Stop_Search();
+            
+            Time_Left[0] = Time_Left[1] = 0;
+            Time_Inc[0] = Time_Inc[1] = 0;
+            Moves_To_Go = 0;
+            Move_Time = 0;
+            Node_Limit = 0;
+            Go_Depth = MAX_PLY;
+            
+            while((t = strtok(NULL, " \t\r\n")) != NULL)
+            {
+                char *v = strcmp(t, "ponder") == 0 || strcmp(t, "infinite") == 0 ? NULL : strtok(NULL, " \t\r\n");
+                long long n = v != NULL ? atoll(v) : 0;
+                
+                if(strcmp(t, "ponder") == 0){ponder = 1;}
+                else if(strcmp(t, "infinite") == 0){infinite = 1;}
+                else if(strcmp(t, "wtime") == 0){Time_Left[0] = n;}
+                else if(strcmp(t, "btime") == 0){Time_Left[1] = n;}
+                else if(strcmp(t, "winc") == 0){Time_Inc[0] = n;}
+                else if(strcmp(t, "binc") == 0){Time_Inc[1] = n;}
+                else if(strcmp(t, "movestogo") == 0){Moves_To_Go = (int)n;}
+                else if(strcmp(t, "movetime") == 0){Move_Time = n;}
+                else if(strcmp(t, "nodes") == 0){Node_Limit = n;}
+                else if(strcmp(t, "depth") == 0){Go_Depth = (int)n;}
+            }
+            if(Time_Left[team] == 0 && Move_Time == 0 && Node_Limit == 0 && Go_Depth == MAX_PLY){infinite = 1;}   // No limit: until stop
+            
+            Soft_Time = 0;
+            Hard_Deadline = 0;
+            Go_Team = team;
+            Write_FEN(team, Go_FEN);
+            memcpy(Game_Hashes, UCI_Game, UCI_Game_Length * sizeof(unsigned long long));   // The search isn't running
+            Game_Length = UCI_Game_Length;
+            
+            atomic_store(&Pondering, ponder || infinite);
+            atomic_store(&Stop, 0);
+            
+            Start_Search();
+        }
+        else if(strcmp(t, "ponderhit") == 0)   // The expected move was played: the clock starts now
+        {
+            if(atomic_load(&Pondering))
+            {
+                Clock_Start = Now();
+                Set_Deadlines(Go_Team, Clock_Start);
+                atomic_store(&Pondering, 0);
+            }
+        }
+        else if(strcmp(t, "stop") == 0){Stop_Search();}
+        else if(strcmp(t, "quit") == 0){break;}
+    }
+    
+    End_Searcher();
+    
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Init_Zobrist();
+    Init_Bitboards();
+    Init_Eval();
+    Init_Pawns();
+    
+    if(argc >= 2 && strcmp(argv[1], "simulate") == 0)
+    {
+        if(argc < 3)
+        {
+            printf("Usage: %s simulate <fen/epd file> [games per position] [threads] [rounds] [-see]\n", argv[0]);
+            return 1;
+        }
+        
+        int values[3] = {100, 1, 100};   // Games per position, threads, rounds
+        int n = 0;
+        
+        for(int i = 3; i < argc; i++)
+        {
+            if(strcmp(argv[i], "-see") == 0){Avoid_Losing_Captures = 1;}
+            else if(n < 3){values[n++] = atoi(argv[i]);}
+        }
+        if(values[0] < 1)
+        {
+            printf("Usage: %s simulate <fen/epd file> [games per position] [threads] [rounds] [-see]\n", argv[0]);
+            printf("At least one game per position\n");
+            return 1;
+        }
+        
+        return Simulate(argv[2], values[0], values[1], values[2]);
+    }
+    
+    if(argc >= 2 && strcmp(argv[1], "search") == 0)
+    {
+        const char *fen = Start_FEN;
+        int depth = MAX_PLY;
+        int scaling = 0;
+        
+        for(int i = 2; i < argc; i++)
+        {
+            if(strcmp(argv[i], "-depth") == 0 && i + 1 < argc){depth = atoi(argv[++i]);}
+            else if(strcmp(argv[i], "-nodes") == 0 && i + 1 < argc){Node_Limit = atoll(argv[++i]);}
+            else if(strcmp(argv[i], "-nonull") == 0){Use_Null = 0;}
+            else if(strcmp(argv[i], "-nolmr") == 0){Use_LMR = 0;}
+            else if(strcmp(argv[i], "-nofutility") == 0){Use_Futility = 0;}
+            else if(strcmp(argv[i], "-norazor") == 0){Use_Razoring = 0;}
+            else if(strcmp(argv[i], "-nopvs") == 0){Use_PVS = 0;}
+            else if(strcmp(argv[i], "-multipv") == 0 && i + 1 < argc){Multi_PV = atoi(argv[++i]);}
+            else if(strcmp(argv[i], "-nnue") == 0 && i + 1 < argc)
+            {
+                if(!NNUE_Load(argv[++i])){return 1;}
+            }
+            else if(strcmp(argv[i], "-pawnhash") == 0 && i + 1 < argc)
+            {
+                long long mb = atoll(argv[++i]);
+                
+                if(mb < 1)
+                {
+                    printf("The pawn hash needs at least 1 MB\n");
+                    return 1;
+                }
+                if(!Pawn_Table_Init(mb))
+                {
+                    printf("Can't allocate the pawn hash table\n");
+                    return 1;
+                }
+            }
+            else if(strcmp(argv[i], "-evalcache") == 0 && i + 1 < argc)
+            {
+                long long kb = atoll(argv[++i]);
+                
+                if(kb < 1)
+                {
+                    printf("The evaluation cache needs at least 1 KB\n");
+                    return 1;
+                }
+                if(!Eval_Cache_Init(kb))
+                {
+                    printf("Can't allocate the evaluation cache\n");
+                    return 1;
+                }
+            }
+            else if(strcmp(argv[i], "-window") == 0 && i + 1 < argc){Aspiration_Window = atoi(argv[++i]);}
+            else if(strcmp(argv[i], "-noprune") == 0){Use_Null = Use_LMR = Use_Futility = Use_Razoring = 0;}
+            else if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc){Search_Threads = atoi(argv[++i]);}
+            else if(strcmp(argv[i], "-wtime") == 0 && i + 1 < argc){Time_Left[0] = atoll(argv[++i]);}
+            else if(strcmp(argv[i], "-btime") == 0 && i + 1 < argc){Time_Left[1] = atoll(argv[++i]);}
+            else if(strcmp(argv[i], "-winc") == 0 && i + 1 < argc){Time_Inc[0] = atoll(argv[++i]);}
+            else if(strcmp(argv[i], "-binc") == 0 && i + 1 < argc){Time_Inc[1] = atoll(argv[++i]);}
+            else if(strcmp(argv[i], "-movestogo") == 0 && i + 1 < argc){Moves_To_Go = atoi(argv[++i]);}
+            else if(strcmp(argv[i], "-movetime") == 0 && i + 1 < argc){Move_Time = atoll(argv[++i]);}
+            else if(strcmp(argv[i], "-overhead") == 0 && i + 1 < argc){Move_Overhead = atoll(argv[++i]);}
+            else if(strcmp(argv[i], "-scaling") == 0){scaling = 1;}
+            else if(strcmp(argv[i], "-hash") == 0 && i + 1 < argc)
+            {
+                char *unit;
+                long long mb = strtoll(argv[++i], &unit, 10);
+                
+                if(*unit == 'G' || *unit == 'g'){mb *= 1024;}   // MB by default, or 4G
+                
+                if(mb < 1)
+                {
+                    printf("The hash needs at least 1 MB\n");
+                    return 1;
+                }
+                if(!TT_Init(mb))
+                {
+                    printf("Can't allocate %lld MB of hash\n", mb);
+                    return 1;
+                }
+            }
+            else{fen = argv[i];}
+        }
+        
+        int team = Load_FEN(fen);
+        
+        if(team == -1)
+        {
+            printf("Invalid position: %s\n", fen);
+            return 1;
+        }
+        if(depth == MAX_PLY && Node_Limit == 0 && Move_Time == 0 && Time_Left[team] == 0){depth = 6;}
+        if(TT == NULL){TT_Init(16);}
+        if(Pawn_Table == NULL){Pawn_Table_Init(1);}
+        if(Eval_Cache == NULL){Eval_Cache_Init(256);}
+        if(Multi_PV < 1){Multi_PV = 1;}
+        if(Multi_PV > 256){Multi_PV = 256;}
+        if(Search_Threads < 1){Search_Threads = 1;}
+        if(Search_Threads > 256){Search_Threads = 256;}
+        
+        if(scaling){return Search_Scaling(team, depth, Search_Threads);}
+        
+        atomic_store(&Stop, 0);
+        Think(team, depth);
+        
+        return 0;
+    }
+    
+    if(argc >= 2 && strcmp(argv[1], "uci") == 0){return UCI();}
+    
+    if(argc >= 2 && strcmp(argv[1], "mate") == 0)
+    {
+        if(argc < 3)
+        {
+            printf("Usage: %s mate <fen or file> [-moves <n>] [-memory <MB>]\n", argv[0]);
+            return 1;
+        }
+        
+        int moves = 30;
+        long long mb = 64;
+        
+        for(int i = 3; i < argc; i++)
+        {
+            if(strcmp(argv[i], "-moves") == 0 && i + 1 < argc){moves = atoi(argv[++i]);}
+            else if(strcmp(argv[i], "-memory") == 0 && i + 1 < argc){mb = atoll(argv[++i]);}
+        }
+        if(moves < 1){moves = 1;}
+        if(mb < 1)
+        {
+            printf("The proof tree needs at least 1 MB\n");
+            return 1;
+        }
+        if(moves > (MAX_PLY + 1) / 2)   // The path is at most MAX_PLY plies long
+        {
+            printf("Mates are searched up to %d moves\n", (MAX_PLY + 1) / 2);
+            return 1;
+        }
+        
+        return Solve_Mates(argv[2], moves, mb);
+    }
+    
+    if(argc >= 2 && strcmp(argv[1], "evaluate") == 0)
+    {
+        if(argc < 3)
+        {
+            printf("Usage: %s evaluate <fen or file> [-threads <n>] [-nnue <file>] [-quiet] [-bench]\n", argv[0]);
+            return 1;
+        }
+        
+        int threads = 1;
+        int quiet = 0;
+        int bench = 0;
+        
+        for(int i = 3; i < argc; i++)
+        {
+            if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc){threads = atoi(argv[++i]);}
+            else if(strcmp(argv[i], "-nnue") == 0 && i + 1 < argc)
+            {
+                if(!NNUE_Load(argv[++i])){return 1;}
+            }
+            else if(strcmp(argv[i], "-quiet") == 0){quiet = 1;}
+            else if(strcmp(argv[i], "-bench") == 0){bench = 1;}
+        }
+        if(Pawn_Table == NULL){Pawn_Table_Init(1);}
+        
+        return Evaluate_File(argv[2], threads, quiet, bench);
+    }
+    
+    if(argc >= 2 && strcmp(argv[1], "fuzz") == 0)
+    {
+        long long games = argc > 2 ? atoll(argv[2]) : 0;
+        int threads     = argc > 3 ? atoi(argv[3]) : 1;
+        int rounds      = argc > 4 ? atoi(argv[4]) : 100;
+        
+        return Fuzz(games, threads, rounds);
+    }
+    
+    if(argc >= 2 && (strcmp(argv[1], "perft") == 0 || strcmp(argv[1], "divide") == 0 || strcmp(argv[1], "regress") == 0))
+    {
+        int regress = strcmp(argv[1], "regress") == 0;
+        
+        if(!regress && (argc < 3 || atoi(argv[2]) < 1))
+        {
+            printf("Usage: %s %s <depth> [fen] [-hash <MB>] [-threads <n>] [-scaling] [-new]\n", argv[0], argv[1]);
+            return 1;
+        }
+        
+        const char *fen = Start_FEN;
+        int threads = 1;
+        int scaling = 0;
+        
+        for(int i = regress ? 2 : 3; i < argc; i++)
+        {
+            if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc){threads = atoi(argv[++i]); continue;}
+            if(strcmp(argv[i], "-scaling") == 0){scaling = 1; continue;}
+            if(strcmp(argv[i], "-new") == 0){New_Generator = 1; continue;}
+            
+            if(strcmp(argv[i], "-hash") == 0 && i + 1 < argc)
+            {
+                int mb = atoi(argv[++i]);
+                
+                if(mb < 1)
+                {
+                    printf("Usage: %s %s <depth> [fen] [-hash <MB>] [-threads <n>] [-scaling] [-new]\n", argv[0], argv[1]);
+                    printf("The perft hash needs at least 1 MB\n");
+                    return 1;
+                }
+                if(!Perft_Table_Init(mb))
+                {
+                    printf("Can't allocate the perft hash table\n");
+                    return 1;
+                }
+            }
+            else{fen = argv[i];}
+        }
+        
+        if(regress){return Run_Regress(threads);}
+        
+        return Run_Perft(fen, atoi(argv[2]), strcmp(argv[1], "divide") == 0, threads, scaling);
+    }
+    
+    Play(100, Load_FEN(Start_FEN));
 }